@@ -0,0 +1,663 @@
+/*
+ * SPDX-FileCopyrightText: Copyright (c) 2023 NVIDIA CORPORATION & AFFILIATES. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Headless benchmark of HrtxMap creation throughput. Bakes synthetic grids of
+// increasing size against a procedural heightmap for every subdivision level
+// and a few batch sizes, and reports the GPU time of each bake stage from
+// hrtxMapStatistics(), micro-vertices per second and memory per map.
+//
+// Usage: hrtx_benchmark [--max-triangles N] [--iterations N]
+
+#include <heightmap_rtx.h>
+#include <vulkan/vulkan_core.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#define CHECK_VK(call) checkVk((call), #call)
+
+static void checkVk(VkResult result, const char* call)
+{
+  if(result != VK_SUCCESS)
+  {
+    fprintf(stderr, "Error: %s returned %d\n", call, static_cast<int>(result));
+    exit(EXIT_FAILURE);
+  }
+}
+
+// Buffers are allocated directly from the device, one allocation each
+struct Allocation
+{
+  VkBuffer       buffer;  // first, so that VkBuffer* can be cast back
+  VkDeviceMemory memory;
+  void*          mapped;
+};
+
+struct Device
+{
+  VkInstance                       instance       = VK_NULL_HANDLE;
+  VkPhysicalDevice                 physicalDevice = VK_NULL_HANDLE;
+  VkDevice                         device         = VK_NULL_HANDLE;
+  uint32_t                         queueFamily    = 0;
+  VkQueue                          queue          = VK_NULL_HANDLE;
+  VkCommandPool                    commandPool    = VK_NULL_HANDLE;
+  VkPhysicalDeviceMemoryProperties memoryProperties{};
+
+  uint32_t memoryType(uint32_t typeBits, VkMemoryPropertyFlags properties) const
+  {
+    for(uint32_t i = 0; i < memoryProperties.memoryTypeCount; ++i)
+    {
+      if((typeBits & (1U << i)) && (memoryProperties.memoryTypes[i].propertyFlags & properties) == properties)
+      {
+        return i;
+      }
+    }
+    fprintf(stderr, "Error: no memory type with properties 0x%x\n", properties);
+    exit(EXIT_FAILURE);
+  }
+
+  Allocation* createBuffer(const VkBufferCreateInfo& createInfo, VkMemoryPropertyFlags properties)
+  {
+    auto allocation = new Allocation{VK_NULL_HANDLE, VK_NULL_HANDLE, nullptr};
+    CHECK_VK(vkCreateBuffer(device, &createInfo, nullptr, &allocation->buffer));
+    VkMemoryRequirements requirements;
+    vkGetBufferMemoryRequirements(device, allocation->buffer, &requirements);
+    VkMemoryAllocateFlagsInfo flagsInfo{VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_FLAGS_INFO, nullptr,
+                                        VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT, 0};
+    VkMemoryAllocateInfo      allocateInfo{
+        VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+        (createInfo.usage & VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT) ? &flagsInfo : nullptr,
+        requirements.size,
+        memoryType(requirements.memoryTypeBits, properties),
+    };
+    CHECK_VK(vkAllocateMemory(device, &allocateInfo, nullptr, &allocation->memory));
+    CHECK_VK(vkBindBufferMemory(device, allocation->buffer, allocation->memory, 0));
+    if(properties & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+    {
+      CHECK_VK(vkMapMemory(device, allocation->memory, 0, VK_WHOLE_SIZE, 0, &allocation->mapped));
+    }
+    return allocation;
+  }
+
+  Allocation* createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties)
+  {
+    VkBufferCreateInfo createInfo{
+        VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO, nullptr, 0, size, usage, VK_SHARING_MODE_EXCLUSIVE, 0, nullptr,
+    };
+    return createBuffer(createInfo, properties);
+  }
+
+  void destroyBuffer(Allocation* allocation)
+  {
+    vkDestroyBuffer(device, allocation->buffer, nullptr);
+    vkFreeMemory(device, allocation->memory, nullptr);
+    delete allocation;
+  }
+
+  VkDeviceAddress address(const Allocation* allocation) const
+  {
+    VkBufferDeviceAddressInfo info{VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO, nullptr, allocation->buffer};
+    return vkGetBufferDeviceAddress(device, &info);
+  }
+
+  VkCommandBuffer beginCommands() const
+  {
+    VkCommandBufferAllocateInfo allocateInfo{VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO, nullptr, commandPool,
+                                             VK_COMMAND_BUFFER_LEVEL_PRIMARY, 1};
+    VkCommandBuffer             cmd;
+    CHECK_VK(vkAllocateCommandBuffers(device, &allocateInfo, &cmd));
+    VkCommandBufferBeginInfo beginInfo{VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO, nullptr,
+                                       VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT, nullptr};
+    CHECK_VK(vkBeginCommandBuffer(cmd, &beginInfo));
+    return cmd;
+  }
+
+  // Submits cmd and waits for the queue to become idle
+  void submitAndWait(VkCommandBuffer cmd) const
+  {
+    CHECK_VK(vkEndCommandBuffer(cmd));
+    VkSubmitInfo submitInfo{VK_STRUCTURE_TYPE_SUBMIT_INFO, nullptr, 0, nullptr, nullptr, 1, &cmd, 0, nullptr};
+    CHECK_VK(vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE));
+    CHECK_VK(vkQueueWaitIdle(queue));
+    vkFreeCommandBuffers(device, commandPool, 1, &cmd);
+  }
+};
+
+static bool hasExtension(const std::vector<VkExtensionProperties>& extensions, const char* name)
+{
+  return std::any_of(extensions.begin(), extensions.end(),
+                     [name](const VkExtensionProperties& extension) {
+                       return strcmp(extension.extensionName, name) == 0;
+                     });
+}
+
+// Creates a device with displacement micromap support and a queue with compute
+// and timestamps. All supported features of the required feature structs are
+// enabled.
+static void createDevice(Device& device)
+{
+  VkApplicationInfo appInfo{
+      VK_STRUCTURE_TYPE_APPLICATION_INFO, nullptr, "hrtx_benchmark", 1, nullptr, 0, VK_API_VERSION_1_3,
+  };
+  VkInstanceCreateInfo instanceInfo{
+      VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO, nullptr, 0, &appInfo, 0, nullptr, 0, nullptr,
+  };
+  CHECK_VK(vkCreateInstance(&instanceInfo, nullptr, &device.instance));
+
+  const std::vector<const char*> deviceExtensions{
+      VK_KHR_ACCELERATION_STRUCTURE_EXTENSION_NAME,
+      VK_KHR_DEFERRED_HOST_OPERATIONS_EXTENSION_NAME,
+      VK_EXT_OPACITY_MICROMAP_EXTENSION_NAME,
+      VK_NV_DISPLACEMENT_MICROMAP_EXTENSION_NAME,
+  };
+  uint32_t physicalDeviceCount = 0;
+  CHECK_VK(vkEnumeratePhysicalDevices(device.instance, &physicalDeviceCount, nullptr));
+  std::vector<VkPhysicalDevice> physicalDevices(physicalDeviceCount);
+  CHECK_VK(vkEnumeratePhysicalDevices(device.instance, &physicalDeviceCount, physicalDevices.data()));
+  for(VkPhysicalDevice physicalDevice : physicalDevices)
+  {
+    uint32_t extensionCount = 0;
+    CHECK_VK(vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &extensionCount, nullptr));
+    std::vector<VkExtensionProperties> extensions(extensionCount);
+    CHECK_VK(vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &extensionCount, extensions.data()));
+    if(std::all_of(deviceExtensions.begin(), deviceExtensions.end(),
+                   [&](const char* name) { return hasExtension(extensions, name); }))
+    {
+      device.physicalDevice = physicalDevice;
+      break;
+    }
+  }
+  if(!device.physicalDevice)
+  {
+    fprintf(stderr, "Error: no device supports %s\n", VK_NV_DISPLACEMENT_MICROMAP_EXTENSION_NAME);
+    exit(EXIT_FAILURE);
+  }
+
+  uint32_t queueFamilyCount = 0;
+  vkGetPhysicalDeviceQueueFamilyProperties(device.physicalDevice, &queueFamilyCount, nullptr);
+  std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+  vkGetPhysicalDeviceQueueFamilyProperties(device.physicalDevice, &queueFamilyCount, queueFamilies.data());
+  device.queueFamily = queueFamilyCount;
+  for(uint32_t i = 0; i < queueFamilyCount; ++i)
+  {
+    if((queueFamilies[i].queueFlags & VK_QUEUE_COMPUTE_BIT) && queueFamilies[i].timestampValidBits > 0)
+    {
+      device.queueFamily = i;
+      break;
+    }
+  }
+  if(device.queueFamily == queueFamilyCount)
+  {
+    fprintf(stderr, "Error: no compute queue with timestamp support\n");
+    exit(EXIT_FAILURE);
+  }
+
+  VkPhysicalDeviceDisplacementMicromapFeaturesNV displacementFeatures{
+      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DISPLACEMENT_MICROMAP_FEATURES_NV};
+  VkPhysicalDeviceOpacityMicromapFeaturesEXT micromapFeatures{
+      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_OPACITY_MICROMAP_FEATURES_EXT, &displacementFeatures};
+  VkPhysicalDeviceAccelerationStructureFeaturesKHR accelerationStructureFeatures{
+      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_FEATURES_KHR, &micromapFeatures};
+  VkPhysicalDeviceVulkan13Features vulkan13Features{VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_3_FEATURES,
+                                                    &accelerationStructureFeatures};
+  VkPhysicalDeviceVulkan12Features vulkan12Features{VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES,
+                                                    &vulkan13Features};
+  VkPhysicalDeviceFeatures2        features2{VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2, &vulkan12Features};
+  vkGetPhysicalDeviceFeatures2(device.physicalDevice, &features2);
+  features2.features.robustBufferAccess = VK_FALSE;  // would skew timings
+  if(!displacementFeatures.displacementMicromap || !vulkan12Features.bufferDeviceAddress
+     || !vulkan13Features.synchronization2)
+  {
+    fprintf(stderr, "Error: required device features are not supported\n");
+    exit(EXIT_FAILURE);
+  }
+
+  float                   queuePriority = 1.0f;
+  VkDeviceQueueCreateInfo queueInfo{
+      VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO, nullptr, 0, device.queueFamily, 1, &queuePriority,
+  };
+  VkDeviceCreateInfo      deviceInfo{
+      VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
+      &features2,
+      0,
+      1,
+      &queueInfo,
+      0,
+      nullptr,
+      static_cast<uint32_t>(deviceExtensions.size()),
+      deviceExtensions.data(),
+      nullptr,
+  };
+  CHECK_VK(vkCreateDevice(device.physicalDevice, &deviceInfo, nullptr, &device.device));
+  vkGetDeviceQueue(device.device, device.queueFamily, 0, &device.queue);
+  vkGetPhysicalDeviceMemoryProperties(device.physicalDevice, &device.memoryProperties);
+
+  VkCommandPoolCreateInfo poolInfo{VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO, nullptr, 0, device.queueFamily};
+  CHECK_VK(vkCreateCommandPool(device.device, &poolInfo, nullptr, &device.commandPool));
+}
+
+static void destroyDevice(Device& device)
+{
+  vkDestroyCommandPool(device.device, device.commandPool, nullptr);
+  vkDestroyDevice(device.device, nullptr);
+  vkDestroyInstance(device.instance, nullptr);
+}
+
+// A procedural R32_SFLOAT heightmap in VK_IMAGE_LAYOUT_GENERAL, as expected by
+// hrtxBarrierFlags()
+struct Heightmap
+{
+  static constexpr uint32_t size = 2048;
+
+  Heightmap(Device& device)
+      : m_device(device)
+  {
+    VkImageCreateInfo imageInfo{
+        VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+        nullptr,
+        0,
+        VK_IMAGE_TYPE_2D,
+        VK_FORMAT_R32_SFLOAT,
+        {size, size, 1},
+        1,
+        1,
+        VK_SAMPLE_COUNT_1_BIT,
+        VK_IMAGE_TILING_OPTIMAL,
+        VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+        VK_SHARING_MODE_EXCLUSIVE,
+        0,
+        nullptr,
+        VK_IMAGE_LAYOUT_UNDEFINED,
+    };
+    CHECK_VK(vkCreateImage(device.device, &imageInfo, nullptr, &m_image));
+    VkMemoryRequirements requirements;
+    vkGetImageMemoryRequirements(device.device, m_image, &requirements);
+    VkMemoryAllocateInfo allocateInfo{
+        VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+        nullptr,
+        requirements.size,
+        device.memoryType(requirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT),
+    };
+    CHECK_VK(vkAllocateMemory(device.device, &allocateInfo, nullptr, &m_memory));
+    CHECK_VK(vkBindImageMemory(device.device, m_image, m_memory, 0));
+
+    // A few octaves of waves so that every texel varies
+    Allocation* staging =
+        device.createBuffer(VkDeviceSize(size) * size * sizeof(float), VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    float*      texels  = static_cast<float*>(staging->mapped);
+    for(uint32_t y = 0; y < size; ++y)
+    {
+      for(uint32_t x = 0; x < size; ++x)
+      {
+        float u = float(x) / float(size), v = float(y) / float(size), height = 0.0f;
+        for(float octave = 1.0f; octave <= 64.0f; octave *= 2.0f)
+        {
+          height += std::sin(u * 6.2831853f * octave + octave) * std::cos(v * 6.2831853f * octave) / octave;
+        }
+        texels[y * size + x] = 0.5f + 0.25f * height;
+      }
+    }
+
+    VkCommandBuffer         cmd = device.beginCommands();
+    VkImageSubresourceRange range{VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+    imageBarrier(cmd, VK_PIPELINE_STAGE_2_NONE, VK_ACCESS_2_NONE, VK_PIPELINE_STAGE_2_TRANSFER_BIT,
+                 VK_ACCESS_2_TRANSFER_WRITE_BIT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+    VkBufferImageCopy copy{0, 0, 0, {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1}, {0, 0, 0}, {size, size, 1}};
+    vkCmdCopyBufferToImage(cmd, staging->buffer, m_image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copy);
+    VkImageLayout         layout;
+    VkPipelineStageFlags2 stageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+    hrtxBarrierFlags(nullptr, nullptr, nullptr, nullptr, &layout);
+    imageBarrier(cmd, VK_PIPELINE_STAGE_2_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT, stageMask,
+                 VK_ACCESS_2_SHADER_READ_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, layout);
+    device.submitAndWait(cmd);
+    device.destroyBuffer(staging);
+
+    VkImageViewCreateInfo viewInfo{
+        VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO, nullptr, 0, m_image, VK_IMAGE_VIEW_TYPE_2D, VK_FORMAT_R32_SFLOAT, {},
+        range,
+    };
+    CHECK_VK(vkCreateImageView(device.device, &viewInfo, nullptr, &m_view));
+    VkSamplerCreateInfo samplerInfo{};
+    samplerInfo.sType        = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+    samplerInfo.magFilter    = VK_FILTER_LINEAR;
+    samplerInfo.minFilter    = VK_FILTER_LINEAR;
+    samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+    samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+    samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+    samplerInfo.maxLod       = VK_LOD_CLAMP_NONE;
+    CHECK_VK(vkCreateSampler(device.device, &samplerInfo, nullptr, &m_sampler));
+    m_descriptor = VkDescriptorImageInfo{m_sampler, m_view, layout};
+  }
+  ~Heightmap()
+  {
+    vkDestroySampler(m_device.device, m_sampler, nullptr);
+    vkDestroyImageView(m_device.device, m_view, nullptr);
+    vkDestroyImage(m_device.device, m_image, nullptr);
+    vkFreeMemory(m_device.device, m_memory, nullptr);
+  }
+  Heightmap(const Heightmap& other)            = delete;
+  Heightmap& operator=(const Heightmap& other) = delete;
+
+  const VkDescriptorImageInfo& descriptor() const { return m_descriptor; }
+
+private:
+  void imageBarrier(VkCommandBuffer       cmd,
+                    VkPipelineStageFlags2 srcStageMask,
+                    VkAccessFlags2        srcAccessMask,
+                    VkPipelineStageFlags2 dstStageMask,
+                    VkAccessFlags2        dstAccessMask,
+                    VkImageLayout         oldLayout,
+                    VkImageLayout         newLayout) const
+  {
+    VkImageMemoryBarrier2 barrier{
+        VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
+        nullptr,
+        srcStageMask,
+        srcAccessMask,
+        dstStageMask,
+        dstAccessMask,
+        oldLayout,
+        newLayout,
+        VK_QUEUE_FAMILY_IGNORED,
+        VK_QUEUE_FAMILY_IGNORED,
+        m_image,
+        {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1},
+    };
+    VkDependencyInfo dependencyInfo{VK_STRUCTURE_TYPE_DEPENDENCY_INFO, nullptr, 0, 0, nullptr, 0, nullptr, 1, &barrier};
+    vkCmdPipelineBarrier2(cmd, &dependencyInfo);
+  }
+
+  Device&               m_device;
+  VkImage               m_image   = VK_NULL_HANDLE;
+  VkDeviceMemory        m_memory  = VK_NULL_HANDLE;
+  VkImageView           m_view    = VK_NULL_HANDLE;
+  VkSampler             m_sampler = VK_NULL_HANDLE;
+  VkDescriptorImageInfo m_descriptor{};
+};
+
+// A flat square grid of gridSize * gridSize quads, each split into two
+// triangles, with texture coordinates covering the heightmap once and
+// directions along +Y
+struct Grid
+{
+  Grid(Device& device, uint32_t gridSize)
+      : vertexCount((gridSize + 1) * (gridSize + 1))
+      , triangleCount(gridSize * gridSize * 2)
+      , m_device(device)
+  {
+    const VkBufferUsageFlags usage = VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
+                                     | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR;
+    const VkMemoryPropertyFlags hostVisible =
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+    positions  = device.createBuffer(VkDeviceSize(vertexCount) * sizeof(float) * 3, usage, hostVisible);
+    texCoords  = device.createBuffer(VkDeviceSize(vertexCount) * sizeof(float) * 2, usage, hostVisible);
+    directions = device.createBuffer(VkDeviceSize(vertexCount) * sizeof(float) * 3, usage, hostVisible);
+    indices    = device.createBuffer(VkDeviceSize(triangleCount) * sizeof(uint32_t) * 3, usage, hostVisible);
+
+    float*    position  = static_cast<float*>(positions->mapped);
+    float*    texCoord  = static_cast<float*>(texCoords->mapped);
+    float*    direction = static_cast<float*>(directions->mapped);
+    uint32_t* index     = static_cast<uint32_t*>(indices->mapped);
+    for(uint32_t y = 0; y <= gridSize; ++y)
+    {
+      for(uint32_t x = 0; x <= gridSize; ++x)
+      {
+        float u = float(x) / float(gridSize), v = float(y) / float(gridSize);
+        *position++  = u;
+        *position++  = 0.0f;
+        *position++  = v;
+        *texCoord++  = u;
+        *texCoord++  = v;
+        *direction++ = 0.0f;
+        *direction++ = 1.0f;
+        *direction++ = 0.0f;
+      }
+    }
+    for(uint32_t y = 0; y < gridSize; ++y)
+    {
+      for(uint32_t x = 0; x < gridSize; ++x)
+      {
+        uint32_t i = y * (gridSize + 1) + x;
+        *index++   = i;
+        *index++   = i + 1;
+        *index++   = i + gridSize + 1;
+        *index++   = i + 1;
+        *index++   = i + gridSize + 2;
+        *index++   = i + gridSize + 1;
+      }
+    }
+  }
+  ~Grid()
+  {
+    m_device.destroyBuffer(positions);
+    m_device.destroyBuffer(texCoords);
+    m_device.destroyBuffer(directions);
+    m_device.destroyBuffer(indices);
+  }
+  Grid(const Grid& other)            = delete;
+  Grid& operator=(const Grid& other) = delete;
+
+  // Triangles of the grid starting at firstTriangle
+  VkAccelerationStructureGeometryTrianglesDataKHR triangles(uint32_t firstTriangle) const
+  {
+    VkAccelerationStructureGeometryTrianglesDataKHR result{};
+    result.sType                    = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_TRIANGLES_DATA_KHR;
+    result.vertexFormat             = VK_FORMAT_R32G32B32_SFLOAT;
+    result.vertexData.deviceAddress = m_device.address(positions);
+    result.vertexStride             = sizeof(float) * 3;
+    result.maxVertex                = vertexCount - 1;
+    result.indexType                = VK_INDEX_TYPE_UINT32;
+    result.indexData.deviceAddress  = m_device.address(indices) + VkDeviceSize(firstTriangle) * sizeof(uint32_t) * 3;
+    return result;
+  }
+
+  uint32_t    vertexCount;
+  uint32_t    triangleCount;
+  Allocation* positions;
+  Allocation* texCoords;
+  Allocation* directions;
+  Allocation* indices;
+
+private:
+  Device& m_device;
+};
+
+struct Result
+{
+  uint64_t     microVertexCount         = 0;
+  uint64_t     setupNanoseconds         = 0;
+  uint64_t     compressNanoseconds      = 0;
+  uint64_t     micromapBuildNanoseconds = 0;
+  VkDeviceSize micromapBytes            = 0;  // kept by the maps
+  VkDeviceSize bakeInputBytes           = 0;  // micromap build inputs, freed with bake resources
+  double       recordMilliseconds       = 0.0;
+
+  uint64_t totalNanoseconds() const { return setupNanoseconds + compressNanoseconds + micromapBuildNanoseconds; }
+};
+
+// Bakes the grid split into mapCount maps of equal size with one
+// hrtxCmdCreateMaps() call
+static Result bake(Device&          device,
+                   HrtxPipeline     pipeline,
+                   const Grid&      grid,
+                   const Heightmap& heightmap,
+                   uint32_t         subdivisionLevel,
+                   uint32_t         mapCount)
+{
+  std::vector<VkAccelerationStructureGeometryTrianglesDataKHR> triangles(mapCount);
+  std::vector<HrtxMapCreate>                                   creates(mapCount);
+  uint32_t trianglesPerMap = grid.triangleCount / mapCount;
+  for(uint32_t i = 0; i < mapCount; ++i)
+  {
+    triangles[i] = grid.triangles(i * trianglesPerMap);
+    creates[i]   = HrtxMapCreate{
+        &triangles[i],
+        i + 1 < mapCount ? trianglesPerMap : grid.triangleCount - i * trianglesPerMap,
+        {device.address(grid.texCoords)},
+        VK_FORMAT_R32G32_SFLOAT,
+        sizeof(float) * 2,
+        {device.address(grid.directions)},
+        VK_FORMAT_R32G32B32_SFLOAT,
+        sizeof(float) * 3,
+        heightmap.descriptor(),
+        0.0f,
+        0.1f,
+        subdivisionLevel,
+        0,
+        nullptr,
+        0,
+        0,
+        0,
+        0,
+    };
+  }
+
+  Result               result;
+  std::vector<HrtxMap> maps(mapCount);
+  VkCommandBuffer      cmd   = device.beginCommands();
+  auto                 start = std::chrono::steady_clock::now();
+  CHECK_VK(hrtxCmdCreateMaps(cmd, pipeline, mapCount, creates.data(), maps.data()));
+  auto end                  = std::chrono::steady_clock::now();
+  result.recordMilliseconds = std::chrono::duration<double, std::milli>(end - start).count();
+  device.submitAndWait(cmd);
+
+  for(uint32_t i = 0; i < mapCount; ++i)
+  {
+    HrtxMapStatistics statistics{};
+    CHECK_VK(hrtxMapStatistics(maps[i], &statistics));
+    result.microVertexCount += statistics.microVertexCount;
+    result.micromapBytes += statistics.micromapSize;
+    result.bakeInputBytes += statistics.valuesSize + statistics.trianglesSize;
+
+    // Batch timings are the same for every map
+    result.setupNanoseconds         = statistics.setupNanoseconds;
+    result.compressNanoseconds      = statistics.compressNanoseconds;
+    result.micromapBuildNanoseconds = statistics.micromapBuildNanoseconds;
+  }
+  for(HrtxMap map : maps)
+  {
+    hrtxDestroyMap(map);
+  }
+  return result;
+}
+
+int main(int argc, char** argv)
+{
+  uint32_t maxTriangles = 1000000;
+  uint32_t iterations   = 3;
+  for(int i = 1; i + 1 < argc; i += 2)
+  {
+    if(strcmp(argv[i], "--max-triangles") == 0)
+    {
+      maxTriangles = static_cast<uint32_t>(strtoul(argv[i + 1], nullptr, 10));
+    }
+    else if(strcmp(argv[i], "--iterations") == 0)
+    {
+      iterations = std::max(1U, static_cast<uint32_t>(strtoul(argv[i + 1], nullptr, 10)));
+    }
+    else
+    {
+      fprintf(stderr, "Usage: %s [--max-triangles N] [--iterations N]\n", argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+
+  Device device;
+  createDevice(device);
+  {
+    HrtxAllocatorCallbacks allocator{
+        [](const VkBufferCreateInfo bufferCreateInfo, const VkMemoryPropertyFlags memoryProperties, void* userPtr) {
+          return &static_cast<Device*>(userPtr)->createBuffer(bufferCreateInfo, memoryProperties)->buffer;
+        },
+        [](VkBuffer* bufferPtr, void* userPtr) {
+          static_cast<Device*>(userPtr)->destroyBuffer(reinterpret_cast<Allocation*>(bufferPtr));
+        },
+        &device,
+        nullptr,
+        [](VkBuffer* bufferPtr, void*) { return reinterpret_cast<Allocation*>(bufferPtr)->mapped; },
+    };
+    HrtxPipelineCreate pipelineCreate{
+        device.physicalDevice,
+        device.device,
+        allocator,
+        VK_NULL_HANDLE,
+        nullptr,
+        nullptr,
+        VK_NULL_HANDLE,
+        [](VkResult result) { checkVk(result, "heightmap_rtx"); },
+        0,
+        0,
+        HRTX_PIPELINE_INSTRUMENTATION_TIMESTAMPS_BIT,
+        0,
+        0,
+        nullptr,
+        0,
+        nullptr,
+        0,
+    };
+    HrtxPipeline    pipeline;
+    VkCommandBuffer cmd = device.beginCommands();
+    CHECK_VK(hrtxCreatePipeline(cmd, &pipelineCreate, &pipeline));
+    device.submitAndWait(cmd);
+
+    Heightmap heightmap(device);
+    printf("%10s %5s %5s %12s %9s %11s %9s %9s %11s %11s %10s\n", "triangles", "level", "maps", "microverts",
+           "setup ms", "compress ms", "build ms", "record ms", "Mverts/s", "KB/map", "input MB");
+    for(uint32_t targetTriangles = 1000; targetTriangles <= maxTriangles; targetTriangles *= 10)
+    {
+      Grid grid(device, static_cast<uint32_t>(std::ceil(std::sqrt(double(targetTriangles) / 2.0))));
+      for(uint32_t level = 0; level <= 5; ++level)
+      {
+        for(uint32_t mapCount : {1U, 16U, 256U})
+        {
+          if(mapCount > grid.triangleCount)
+          {
+            continue;
+          }
+
+          // Keep the fastest iteration, the first includes arena allocation
+          Result best;
+          for(uint32_t iteration = 0; iteration < iterations; ++iteration)
+          {
+            Result result = bake(device, pipeline, grid, heightmap, level, mapCount);
+            if(iteration == 0 || result.totalNanoseconds() < best.totalNanoseconds())
+            {
+              best = result;
+            }
+
+            // Forgets the destroyed maps' bake resources
+            hrtxPipelineReleaseBakeResources(pipeline, 0);
+          }
+          printf("%10u %5u %5u %12llu %9.3f %11.3f %9.3f %9.3f %11.1f %11.1f %10.1f\n", grid.triangleCount, level,
+                 mapCount, static_cast<unsigned long long>(best.microVertexCount), best.setupNanoseconds * 1e-6,
+                 best.compressNanoseconds * 1e-6, best.micromapBuildNanoseconds * 1e-6, best.recordMilliseconds,
+                 best.totalNanoseconds() ? double(best.microVertexCount) * 1e3 / double(best.totalNanoseconds()) : 0.0,
+                 double(best.micromapBytes) / 1024.0 / mapCount, double(best.bakeInputBytes) / (1024.0 * 1024.0));
+        }
+      }
+    }
+    hrtxDestroyPipeline(pipeline);
+  }
+  destroyDevice(device);
+  return EXIT_SUCCESS;
+}
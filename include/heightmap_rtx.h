@@ -40,6 +40,18 @@ extern "C" {
 //  ... image barrier based on hrtxBarrierFlags()
 //  hrtxMap = hrtxCmdCreateMap(cmd, pipeline, ...)
 //  ... memory barrier based on hrtxBarrierFlags()
+//
+// Thread safety: functions taking a pipeline may be called concurrently on
+// the same pipeline, recording into different command buffers, as long as
+// each HrtxMap is used by one thread at a time, e.g. to create maps on
+// several worker threads. The pipeline's buffer suballocators, bias and scale
+// table and bindless heightmap array are internally synchronized, and every
+// command buffer uploads the bias and scale of its own maps. The
+// HrtxAllocatorCallbacks must be thread-safe too. hrtxPipelineMarkSubmitted()
+// only tags resources recorded into the given command buffers, but
+// hrtxPipelineReleaseBakeResources() releases those of all threads' maps and
+// must not run concurrently with other calls using those maps.
+// hrtxDestroyPipeline() must not run concurrently with any other call.
 typedef struct HrtxPipeline_T* HrtxPipeline;
 
 // Heightmap displacement object for raytracing displaced geometry.
@@ -55,6 +67,7 @@ typedef VkBuffer* (*PFN_hrtxCreateBuffer)(const VkBufferCreateInfo    bufferCrea
                                           const VkMemoryPropertyFlags memoryProperties,
                                           void*                       userPtr);
 typedef void (*PFN_hrtxDestroyBuffer)(VkBuffer* bufferPtr, void* userPtr);
+typedef void* (*PFN_hrtxMapBuffer)(VkBuffer* bufferPtr, void* userPtr);
 typedef void (*PFN_hrtxCheckVkResult)(VkResult result);
 
 typedef struct HrtxAllocatorCallbacks
@@ -65,8 +78,50 @@ typedef struct HrtxAllocatorCallbacks
 
   // Optional
   const VkAllocationCallbacks* systemAllocator;
+
+  // Optional. Returns a pointer to the memory of a buffer created with
+  // VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+  // which must remain valid until the buffer is destroyed. Required for
+  // HRTX_MAP_CREATE_ADAPTIVE_SUBDIVISION_BIT and map serialization.
+  PFN_hrtxMapBuffer mapBuffer;
 } HrtxAllocatorCallbacks;
 
+typedef enum HrtxPipelineInstrumentationFlagBits
+{
+  // Write GPU timestamps around the stages of each bake, reported by
+  // hrtxMapStatistics(). The bake queue family must have non-zero
+  // timestampValidBits.
+  HRTX_PIPELINE_INSTRUMENTATION_TIMESTAMPS_BIT = 0x00000001,
+
+  // Count compress shader invocations of each bake with a pipeline statistics
+  // query. Requires the pipelineStatisticsQuery device feature.
+  HRTX_PIPELINE_INSTRUMENTATION_PIPELINE_STATISTICS_BIT = 0x00000002,
+} HrtxPipelineInstrumentationFlagBits;
+typedef VkFlags HrtxPipelineInstrumentationFlags;
+
+typedef enum HrtxPipelineCreateFlagBits
+{
+  // Bind heightmaps from a pipeline-owned, update-after-bind descriptor array
+  // rather than allocating a descriptor pool and set for every bake. Each
+  // unique heightmap is written to the array once and keeps its slot while any
+  // unreleased bake uses it, so the unique heightmaps of unreleased bakes are
+  // limited by bindlessHeightmapCount. Requires the
+  // descriptorBindingSampledImageUpdateAfterBind,
+  // descriptorBindingUpdateUnusedWhilePending and
+  // descriptorBindingPartiallyBound device features.
+  HRTX_PIPELINE_CREATE_BINDLESS_HEIGHTMAPS_BIT = 0x00000001,
+
+  // Compile the bake shader variants on a background thread, so that
+  // hrtxCreatePipeline() returns without waiting for them. hrtxPipelineStatus()
+  // returns VK_NOT_READY until they are ready, and recording a bake before
+  // then waits for them. checkResultCallback may be called from the
+  // background thread, where it must not throw. An external pipelineCache
+  // must not be created with
+  // VK_PIPELINE_CACHE_CREATE_EXTERNALLY_SYNCHRONIZED_BIT.
+  HRTX_PIPELINE_CREATE_DEFERRED_COMPILE_BIT = 0x00000002,
+} HrtxPipelineCreateFlagBits;
+typedef VkFlags HrtxPipelineCreateFlags;
+
 typedef struct HrtxPipelineCreate
 {
   VkPhysicalDevice       physicalDevice;
@@ -78,26 +133,152 @@ typedef struct HrtxPipelineCreate
   PFN_vkGetInstanceProcAddr getInstanceProcAddr;
   PFN_vkGetDeviceProcAddr   getDeviceProcAddr;
 
-  // Optional: cache internal shaders
+  // Optional: cache internal shaders. Otherwise the pipeline creates its own
+  // from pipelineCacheData, see hrtxPipelineCacheData().
   VkPipelineCache pipelineCache;
 
   // Optional: callback to catch any failures from internal vulkan calls, e.g. to
   // throw an exception from and abort creating displacement.
   PFN_hrtxCheckVkResult checkResultCallback;
+
+  // Optional: size of the buffers that scratch memory, bake inputs and
+  // micromaps are suballocated from. Larger allocations get their own buffer.
+  // Zero selects a default of 32MB.
+  VkDeviceSize arenaBlockSize;
+
+  // Optional: workgroup size of the internal bake shader, clamped to device
+  // limits. Larger sizes, e.g. 64 or 128, may give better occupancy on some
+  // devices. Zero selects a default of 32.
+  uint32_t compressWorkgroupSize;
+
+  // Optional: HrtxPipelineInstrumentationFlagBits, e.g. to measure bake costs
+  // for streaming budgets
+  HrtxPipelineInstrumentationFlags instrumentationFlags;
+
+  // Optional: HrtxPipelineCreateFlagBits
+  HrtxPipelineCreateFlags flags;
+
+  // Optional: size of the heightmap array with
+  // HRTX_PIPELINE_CREATE_BINDLESS_HEIGHTMAPS_BIT, clamped to the device's
+  // update-after-bind sampler limits. Zero selects a default of 1024.
+  uint32_t bindlessHeightmapCount;
+
+  // Optional: SPIR-V of the internal bake shader compiled with a custom
+  // sampleHeight() by heightmap_rtx_compile_compress_shader(), e.g. for
+  // virtual textures or bicubic filtering. Its variants are cached in
+  // pipelineCache like the default shader. The code is only read during
+  // hrtxCreatePipeline() and must be compiled from the same library version.
+  const uint32_t* compressShaderCode;
+  size_t          compressShaderCodeSize;  // in bytes
+
+  // Optional: initial data of the pipeline's own cache when pipelineCache is
+  // VK_NULL_HANDLE, from hrtxPipelineCacheData() of an earlier run, so that
+  // warm starts skip compiling the shaders. Vulkan ignores data from a
+  // different device or driver version.
+  const void* pipelineCacheData;
+  size_t      pipelineCacheDataSize;
 } HrtxPipelineCreate;
 
 // Takes a command buffer that will be filled with initialization operations,
 // e.g. compiling shaders and device transfers for common data used to create
-// HrtxMap objects. Memory barriers for these are inserted into cmd.
+// HrtxMap objects. Memory barriers for these are inserted into cmd. When
+// baking on a dedicated queue, cmd must be submitted to a queue of the same
+// family, as the pipeline's internal buffers are not transferred.
 VkResult hrtxCreatePipeline(VkCommandBuffer cmd, const HrtxPipelineCreate* create, HrtxPipeline* hrtxPipeline);
 
+// Returns VK_NOT_READY while a pipeline created with
+// HRTX_PIPELINE_CREATE_DEFERRED_COMPILE_BIT is still compiling its shaders,
+// otherwise VK_SUCCESS.
+VkResult hrtxPipelineStatus(HrtxPipeline hrtxPipeline);
+
+// Retrieves the data of the pipeline cache the shaders were compiled with,
+// i.e. HrtxPipelineCreate::pipelineCache or the pipeline's own, to pass as
+// HrtxPipelineCreate::pipelineCacheData on the next run. If data is NULL,
+// writes the size of the data to *dataSize. Otherwise copies up to *dataSize
+// bytes and returns VK_INCOMPLETE if that was not all of it, as
+// vkGetPipelineCacheData() does. Waits for deferred compilation to finish.
+VkResult hrtxPipelineCacheData(HrtxPipeline hrtxPipeline, size_t* dataSize, void* data);
+
+typedef enum HrtxMapCreateFlagBits
+{
+  // Build the micromap with VK_BUILD_MICROMAP_ALLOW_COMPACTION_BIT_EXT and query
+  // its compacted size, so that it can later be shrunk with hrtxCmdCompactMap()
+  HRTX_MAP_CREATE_ALLOW_COMPACTION_BIT = 0x00000001,
+
+  // Generate displacement bounds, i.e. per-vertex bias and scale that tightly
+  // fit the heights of adjacent triangles, for faster raytracing. Requires
+  // HrtxMapCreate::triangles->maxVertex. This adds a pass over the heightmap
+  // and a buffer of maxVertex + 1 bias and scale pairs, and the map is not
+  // affected by hrtxCmdUpdateMapBiasScale().
+  HRTX_MAP_CREATE_DISPLACEMENT_BOUNDS_BIT = 0x00000002,
+
+  // Choose a subdivision level per triangle, up to HrtxMapCreate::
+  // subdivisionLevel, from the number of heightmap texels it covers so that
+  // micro-vertices roughly match texels. Creation is split into two phases:
+  // hrtxCmdCreateMaps() records a pass that computes the levels, then
+  // hrtxCmdBuildMaps() bakes the maps once that has completed, since the
+  // micromap sizes depend on it. Levels are raised so that triangles sharing
+  // a vertex index differ by at most one, and hrtxMapDesc() references
+  // per-triangle edge decimation flags for the finer side of each edge between
+  // two levels. Neighbours are only found through shared vertex indices up
+  // to triangles->maxVertex, so UV seams that split vertices may crack.
+  // Requires HrtxAllocatorCallbacks::mapBuffer and a subdivisionLevel of at
+  // most 5, otherwise VK_ERROR_FEATURE_NOT_PRESENT is returned.
+  HRTX_MAP_CREATE_ADAPTIVE_SUBDIVISION_BIT = 0x00000004,
+
+  // Keep the micromap's values and triangles so that regions can be re-baked
+  // with hrtxCmdUpdateMap(), e.g. for editable terrain. The map's input
+  // buffers must remain valid for its lifetime. Not compatible with
+  // HRTX_MAP_CREATE_DISPLACEMENT_BOUNDS_BIT, for which
+  // VK_ERROR_FEATURE_NOT_PRESENT is returned, and prevents compaction.
+  HRTX_MAP_CREATE_ALLOW_UPDATE_BIT = 0x00000008,
+
+  // Bake edges shared by triangles with the same vertex indices to
+  // bit-identical values. Texture coordinates and directions are interpolated
+  // from a triangle's vertices in the order of their indices, without fused
+  // operations, so both neighbours compute the same result. Heights are also
+  // scaled by the ratio of the interpolated direction lengths to the length of
+  // the interpolated direction, compensating for the raytracing hardware not
+  // normalizing them. This uses the bias and scale at bake time and the result
+  // is clamped to their range. Requires directionsFormat
+  // VK_FORMAT_R32G32B32_SFLOAT, otherwise VK_ERROR_FORMAT_NOT_SUPPORTED is
+  // returned, and directions with VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT.
+  // UV seams that split vertices are not stitched.
+  HRTX_MAP_CREATE_SEAMLESS_EDGES_BIT = 0x00000010,
+
+  // Sample the heightmap at the mip level whose texels match the spacing of
+  // each base triangle's micro-vertices, from its texture coordinate area and
+  // subdivision level, rather than always at mip 0. Avoids aliasing and
+  // scattered fetches for triangles much larger than their micro-triangles.
+  // The heightmap must have a full mip chain, or a sampler whose minLod
+  // clamps to the levels that are resident, e.g. when streaming only the
+  // coarse mips of a huge heightmap. The level differs between neighbouring
+  // triangles of different sizes, so edges are not bit-identical with
+  // HRTX_MAP_CREATE_SEAMLESS_EDGES_BIT where the level changes.
+  HRTX_MAP_CREATE_FOOTPRINT_MIP_SAMPLING_BIT = 0x00000020,
+
+  // Keep a second micromap so that the map can be re-baked every frame with
+  // hrtxCmdRebakeMap(), e.g. for water or animated terrain. Re-bakes and
+  // hrtxCmdUpdateMap() build into the micromap that hrtxMapDesc() did not
+  // return, which then becomes current, so rays still tracing the previous
+  // frame's micromap are unaffected. Requires HRTX_MAP_CREATE_ALLOW_UPDATE_BIT
+  // and is not supported with HRTX_MAP_CREATE_ADAPTIVE_SUBDIVISION_BIT, for
+  // which VK_ERROR_FEATURE_NOT_PRESENT is returned.
+  HRTX_MAP_CREATE_DYNAMIC_BIT = 0x00000040,
+} HrtxMapCreateFlagBits;
+typedef VkFlags HrtxMapCreateFlags;
+
 typedef struct HrtxMapCreate
 {
-  // Currently only VK_INDEX_TYPE_UINT32 is supported
+  // VK_INDEX_TYPE_UINT32, VK_INDEX_TYPE_UINT16 or VK_INDEX_TYPE_UINT8_EXT,
+  // which are read directly by the bake. Only VK_INDEX_TYPE_UINT32 is
+  // supported with a subdivisionLevel above 5.
   // Indices must have VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT set
   const VkAccelerationStructureGeometryTrianglesDataKHR* triangles;
   uint32_t                                               primitiveCount;
-  // Currently only VK_FORMAT_R32G32_SFLOAT is supported
+  // VK_FORMAT_R32G32_SFLOAT, VK_FORMAT_R16G16_SFLOAT or VK_FORMAT_R16G16_UNORM,
+  // with a stride that is a multiple of 4 bytes. Only VK_FORMAT_R32G32_SFLOAT
+  // is supported with a subdivisionLevel above 5.
   // Texture coords must have VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT set
   VkDeviceOrHostAddressConstKHR textureCoordsBuffer;
   VkFormat                      textureCoordsFormat;
@@ -108,7 +289,67 @@ typedef struct HrtxMapCreate
   VkDescriptorImageInfo         heightmapImage;
   float                         heightmapBias;
   float                         heightmapScale;
+  // Maximum 9, otherwise VK_ERROR_FORMAT_NOT_SUPPORTED is returned. The
+  // maximum per-triangle level with HRTX_MAP_CREATE_ADAPTIVE_SUBDIVISION_BIT,
+  // which supports at most 5. Above 5, each triangle is first split into
+  // 4^(subdivisionLevel - 5) triangles on the GPU, which must then be used to
+  // build the BVH, see hrtxMapPretessellatedGeometry(). This requires
+  // triangles->vertexData to have VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+  // and triangles->vertexFormat and directionsFormat to be
+  // VK_FORMAT_R32G32B32_SFLOAT. The tessellated vertex and triangle counts
+  // must fit in 32 bits, otherwise VK_ERROR_TOO_MANY_OBJECTS is returned.
   uint32_t                      subdivisionLevel;
+
+  // Optional: HrtxMapCreateFlagBits
+  HrtxMapCreateFlags flags;
+
+  // Optional: the range used to build the BVH from shared index and vertex
+  // buffers. primitiveOffset is a byte offset into the index data and must be
+  // a multiple of the index size. firstVertex is added to every index when
+  // reading texture coordinates, and vertex positions and directions for
+  // pre-tessellation. primitiveCount and transformOffset are ignored. A
+  // non-zero firstVertex is not supported with
+  // HRTX_MAP_CREATE_DISPLACEMENT_BOUNDS_BIT and VK_ERROR_FEATURE_NOT_PRESENT
+  // is returned. Pre-tessellated geometry has its own buffers and must be
+  // built with a zero offset range.
+  const VkAccelerationStructureBuildRangeInfoKHR* buildRange;
+
+  // Optional: passed to a custom sampleHeight(), see
+  // HrtxPipelineCreate::compressShaderCode. Ignored by the default shader.
+  VkDeviceAddress sampleUserData;
+
+  // Optional: device address of a uint32_t with the number of triangles to
+  // bake, written by earlier GPU work such as culling or procedural
+  // generation, so that no readback is needed. primitiveCount is then the
+  // maximum, which sizes the map, its bake dispatch and its micromap.
+  // Triangles from the device-side count up to primitiveCount are not
+  // sampled and their indices and texture coordinates are not read, but they
+  // remain in the micromap with undefined values, so the BVH must be built
+  // with the device-side count, e.g. with
+  // vkCmdBuildAccelerationStructuresIndirectKHR(). The count needs the same
+  // barrier as textureCoordsBuffer, and must remain valid for the lifetime of
+  // maps with HRTX_MAP_CREATE_ALLOW_UPDATE_BIT. Not supported with
+  // HRTX_MAP_CREATE_ADAPTIVE_SUBDIVISION_BIT or a subdivisionLevel above 5,
+  // for which VK_ERROR_FEATURE_NOT_PRESENT is returned.
+  VkDeviceAddress primitiveCountAddress;
+
+  // Optional: number of levels of detail to bake, so that distant instances
+  // can trace cheaper micromaps with smaller BVHs. LOD 0 is at
+  // subdivisionLevel and each following LOD is lodLevelStep levels coarser,
+  // e.g. 3 LODs with a step of 2 from level 5 are at levels 5, 3 and 1. LODs
+  // that would be below level 0 are dropped, so a map has at most
+  // subdivisionLevel / lodLevelStep + 1. All LODs are baked in the same batch
+  // and micromap build and share the map's heightmapBias and heightmapScale,
+  // but with HRTX_MAP_CREATE_DISPLACEMENT_BOUNDS_BIT each LOD has its own
+  // per-vertex bias and scale fitted to its heights. Their descriptors are
+  // returned by hrtxMapLodDesc(), to build a BVH per LOD for instances to
+  // choose from.
+  // Zero bakes just subdivisionLevel. Not supported with
+  // HRTX_MAP_CREATE_ADAPTIVE_SUBDIVISION_BIT, HRTX_MAP_CREATE_ALLOW_UPDATE_BIT
+  // or a subdivisionLevel above 5, for which VK_ERROR_FEATURE_NOT_PRESENT is
+  // returned.
+  uint32_t lodCount;
+  uint32_t lodLevelStep;  // zero is treated as one
 } HrtxMapCreate;
 
 void hrtxDestroyPipeline(HrtxPipeline hrtxPipeline);
@@ -119,6 +360,7 @@ void hrtxDestroyPipeline(HrtxPipeline hrtxPipeline);
 // - HrtxMapCreate::textureCoordsBuffer
 // - HrtxMapCreate::directionsBuffer
 // - HrtxMapCreate::heightmapImage
+// - HrtxMapCreate::primitiveCountAddress, with the texture coordinate masks
 //
 // Barriers for resources created and returned by hrtxMapDesc() will be inserted
 // during HrtxMap creation as it is assumed these will be passed to an
@@ -130,15 +372,386 @@ void hrtxBarrierFlags(VkPipelineStageFlags2* textureCoordsDstStageMask,
                       VkAccessFlags2*        directionsDstAccessMask,
                       VkImageLayout*         heightmapLayout);
 
+typedef enum HrtxQueueFamilyTransfer
+{
+  // The barrier recorded on the source queue family, before signalling a
+  // semaphore the destination queue waits on
+  HRTX_QUEUE_FAMILY_TRANSFER_RELEASE = 0,
+
+  // The matching barrier recorded on the destination queue family
+  HRTX_QUEUE_FAMILY_TRANSFER_ACQUIRE = 1,
+} HrtxQueueFamilyTransfer;
+
+// Baking on a dedicated queue, e.g. async compute, to overlap it with graphics
+// work. Inputs in VK_SHARING_MODE_EXCLUSIVE buffers and images owned by
+// another queue family must be transferred to the bake queue's family, and the
+// maps' outputs back for the BVH build. This fills in the library's half of the
+// input barriers for hrtxBarrierFlags(): sType, the queue family indices and
+// the heightmap's newLayout, as well as dstStageMask and dstAccessMask for an
+// acquire, or clears them for a release, where they are ignored. For an
+// acquire, srcStageMask and srcAccessMask are also cleared. The caller sets
+// the buffer ranges, image and subresourceRange and oldLayout, which must be
+// identical in both barriers, and srcStageMask and srcAccessMask of a
+// release. Inputs are only read, so after they have been used the caller can
+// transfer them back with the same stages swapped. Barriers that are null are
+// ignored, e.g. directions need not be transferred unless the subdivision
+// level is above 5.
+void hrtxInputQueueFamilyTransferBarriers(HrtxQueueFamilyTransfer transfer,
+                                          uint32_t                srcQueueFamilyIndex,
+                                          uint32_t                dstQueueFamilyIndex,
+                                          VkBufferMemoryBarrier2* textureCoordsBarrier,
+                                          VkBufferMemoryBarrier2* directionsBarrier,
+                                          VkImageMemoryBarrier2*  heightmapBarrier);
+
 VkResult hrtxCmdCreateMap(VkCommandBuffer cmd, HrtxPipeline hrtxPipeline, const HrtxMapCreate* create, HrtxMap* hrtxMap);
 
+// Batched hrtxCmdCreateMap(). Creates createCount HrtxMap objects, written to
+// hrtxMaps, with much less command overhead than creating them individually.
+// All maps are baked in a single compute dispatch and a single micromap build,
+// with one set of barriers. Intermediate buffers are shared by the batch. The
+// number of unique heightmaps in a batch is limited by the device's maximum
+// per-stage sampler/sampled image descriptors, or by the free slots of the
+// pipeline's heightmap array with HRTX_PIPELINE_CREATE_BINDLESS_HEIGHTMAPS_BIT,
+// otherwise VK_ERROR_TOO_MANY_OBJECTS is returned. A createCount of zero
+// records nothing and returns VK_SUCCESS.
+VkResult hrtxCmdCreateMaps(VkCommandBuffer      cmd,
+                           HrtxPipeline         hrtxPipeline,
+                           uint32_t             createCount,
+                           const HrtxMapCreate* creates,
+                           HrtxMap*             hrtxMaps);
+
+// Second phase of creation for maps created with
+// HRTX_MAP_CREATE_ADAPTIVE_SUBDIVISION_BIT. The command buffer passed to
+// hrtxCmdCreateMaps() must have completed execution, and the map's input
+// buffers and heightmap must still be valid. Records the bake and micromap
+// build, batched as in hrtxCmdCreateMaps(). hrtxMapDesc() must not be called
+// before this. Returns VK_ERROR_INITIALIZATION_FAILED if a map is not waiting
+// to be built, and VK_NOT_READY, recording nothing, if a map's levels have not
+// been read back yet, i.e. the command buffer has not completed.
+VkResult hrtxCmdBuildMaps(VkCommandBuffer cmd, HrtxPipeline hrtxPipeline, uint32_t mapCount, const HrtxMap* hrtxMaps);
+
 void hrtxDestroyMap(HrtxMap hrtxMap);
 
+// Records buffer barriers that release or acquire the buffers of mapCount
+// maps that are read by the BVH build, i.e. the micromap, bias and scale and
+// pre-tessellated geometry, e.g. to build the BVH on a graphics queue
+// after baking on an async compute queue. Both the release on the bake queue
+// and the acquire on the destination queue must be recorded after the maps
+// are baked, or compacted, with the same arguments. Any later
+// hrtxCmdUpdateMap(), hrtxCmdCompactMap() or hrtxCmdUpdateMapBiasScale() must
+// be recorded on the bake queue's family, after transferring the maps back.
+// Returns VK_ERROR_INITIALIZATION_FAILED if a map is waiting for
+// hrtxCmdBuildMaps().
+VkResult hrtxCmdMapsQueueFamilyTransfer(VkCommandBuffer         cmd,
+                                        HrtxPipeline            hrtxPipeline,
+                                        HrtxQueueFamilyTransfer transfer,
+                                        uint32_t                srcQueueFamilyIndex,
+                                        uint32_t                dstQueueFamilyIndex,
+                                        uint32_t                mapCount,
+                                        const HrtxMap*          hrtxMaps);
+
+// Texture coordinate rectangle, inclusive
+typedef struct HrtxMapRegion
+{
+  float minU;
+  float minV;
+  float maxU;
+  float maxV;
+} HrtxMapRegion;
+
+// Re-bakes the triangles of a map created with
+// HRTX_MAP_CREATE_ALLOW_UPDATE_BIT whose texture coordinates overlap region,
+// after the heightmap has been modified there, and rebuilds the micromap.
+// Texture coordinates are compared directly, without wrapping. Triangles
+// within the filter footprint of the region are included too, i.e. half a
+// texel, or with HRTX_MAP_CREATE_FOOTPRINT_MIP_SAMPLING_BIT the texels
+// averaged into the mip level they sample, whose mips must be regenerated
+// over the region first. A custom sampleHeight() reading further away needs
+// the caller to pad the region by that distance. Sampling cost
+// is proportional to the updated triangles. Acceleration structures using the
+// map must be rebuilt afterwards. The heightmap needs the same barrier as for
+// hrtxCmdCreateMap(). Returns VK_ERROR_FEATURE_NOT_PRESENT for other maps and
+// VK_ERROR_INITIALIZATION_FAILED for adaptive maps that have not been built,
+// or VK_ERROR_TOO_MANY_OBJECTS if the pipeline's bindless heightmap array is
+// full.
+VkResult hrtxCmdUpdateMap(VkCommandBuffer cmd, HrtxPipeline hrtxPipeline, HrtxMap hrtxMap, const HrtxMapRegion* region);
+
+// Re-bakes every triangle of a map created with HRTX_MAP_CREATE_DYNAMIC_BIT
+// from the current contents of its heightmap, and builds the result into the
+// map's other micromap, which hrtxMapDesc() then returns. The geometry table,
+// heightmap binding and build scratch are created by the first call and kept
+// until the map is destroyed, so later calls only record GPU work. The
+// descriptor differs from the previous one only in its micromap, so a BVH
+// built with VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR and
+// VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_DISPLACEMENT_MICROMAP_UPDATE_NV can be
+// updated in place with VK_BUILD_ACCELERATION_STRUCTURE_MODE_UPDATE_KHR
+// instead of rebuilt. The micromap written is the one current two re-bakes
+// ago, so work using that descriptor must have completed, or be ordered before
+// cmd. The heightmap needs the same barrier as for hrtxCmdCreateMap(). Returns
+// VK_ERROR_FEATURE_NOT_PRESENT for other maps, or VK_ERROR_TOO_MANY_OBJECTS if
+// the pipeline's bindless heightmap array is full on the first call.
+VkResult hrtxCmdRebakeMap(VkCommandBuffer cmd, HrtxPipeline hrtxPipeline, HrtxMap hrtxMap);
+
+// Changes the bias and scale of mapCount maps, e.g. to animate displacement.
+// Values for all maps of a pipeline are packed into shared buffers and written
+// with as few transfers as possible, followed by a barrier for the user's BVH
+// build. The maps' acceleration structures must be rebuilt to see the change.
+// biases and scales are arrays of mapCount values. Maps created with
+// HRTX_MAP_CREATE_DISPLACEMENT_BOUNDS_BIT are skipped.
+void hrtxCmdUpdateMapBiasScale(VkCommandBuffer cmd,
+                               HrtxPipeline    hrtxPipeline,
+                               uint32_t        mapCount,
+                               const HrtxMap*  hrtxMaps,
+                               const float*    biases,
+                               const float*    scales);
+
+// Second phase of micromap compaction for maps created with
+// HRTX_MAP_CREATE_ALLOW_COMPACTION_BIT. Once the command buffer that created
+// hrtxMap has completed, this records a copy of the micromap, and that of each
+// level of detail, into a tightly sized one, which replaces it. Acceleration
+// structures must be rebuilt with a new hrtxMapDesc() afterwards. Returns
+// VK_NOT_READY if the creation commands have not yet completed. Must be called
+// before hrtxMapReleaseBakeResources(). The original micromap is kept until
+// bake resources are released, which must then wait for the compaction commands
+// to complete too.
+VkResult hrtxCmdCompactMap(VkCommandBuffer cmd, HrtxPipeline hrtxPipeline, HrtxMap hrtxMap);
+
+// Frees the intermediate buffers, scratch memory and descriptors used to bake
+// hrtxMap, leaving only the micromap and bias/scale slot needed for raytracing.
+// The command buffer passed to hrtxCmdCreateMap() must have completed
+// execution. Resources shared by a hrtxCmdCreateMaps() batch are freed once
+// every map in the batch has been released or destroyed.
+void hrtxMapReleaseBakeResources(HrtxMap hrtxMap);
+
+// Alternative to calling hrtxMapReleaseBakeResources() for every map. Tags the
+// bake, load, update and compaction resources that were recorded with
+// hrtxPipeline into any of commandBuffers and are not yet tagged. They are
+// tagged with submitValue, e.g. the value a timeline semaphore will be
+// signalled with once those command buffers complete. Resources recorded into
+// other command buffers, such as those of other threads that have not been
+// submitted yet, are left untagged. Call this with the command buffers of each
+// submit, before they are reset or recorded again.
+void hrtxPipelineMarkSubmitted(HrtxPipeline           hrtxPipeline,
+                               uint32_t               commandBufferCount,
+                               const VkCommandBuffer* commandBuffers,
+                               uint64_t               submitValue);
+
+// Releases bake resources for all maps tagged by hrtxPipelineMarkSubmitted()
+// with a submitValue less than or equal to completedValue, e.g. the current
+// value from vkGetSemaphoreCounterValue(). Maps from the same
+// hrtxCmdCreateMaps() batch are released together.
+void hrtxPipelineReleaseBakeResources(HrtxPipeline hrtxPipeline, uint64_t completedValue);
+
+// Memory of a BufferArena the pipeline suballocates from. blockSize is the
+// device memory allocated, of which allocatedSize is in use.
+typedef struct HrtxPipelineArenaStatistics
+{
+  uint32_t     blockCount;
+  VkDeviceSize blockSize;
+  VkDeviceSize allocatedSize;
+} HrtxPipelineArenaStatistics;
+
+typedef struct HrtxPipelineStatistics
+{
+  HrtxPipelineArenaStatistics scratchArena;     // micromap build scratch
+  HrtxPipelineArenaStatistics bakeArena;        // values, triangles and shader inputs
+  HrtxPipelineArenaStatistics micromapArena;    // micromap storage
+  HrtxPipelineArenaStatistics vertexDataArena;  // per-vertex bias and scale and pre-tessellated geometry
+
+  // Bias and scale table, one slot per map
+  VkDeviceSize biasScaleTableSize;
+  uint32_t     biasScaleSlotCount;
+  uint32_t     biasScaleSlotsInUse;
+
+  // Heightmap descriptor array with HRTX_PIPELINE_CREATE_BINDLESS_HEIGHTMAPS_BIT,
+  // otherwise zero. Vulkan does not report descriptor memory, so this is in
+  // descriptors rather than bytes.
+  uint32_t heightmapSlotCount;
+  uint32_t heightmapSlotsInUse;
+
+  // Bake, update and load resources tracked for
+  // hrtxPipelineReleaseBakeResources() that are still held by a map,
+  // including those not yet tagged by hrtxPipelineMarkSubmitted()
+  uint32_t pendingBakeResourceCount;
+  uint32_t unsubmittedBakeResourceCount;
+} HrtxPipelineStatistics;
+
+// Writes the memory held by hrtxPipeline and its maps to *statistics, e.g. for
+// memory budgets or to decide when to release bake resources. May be called
+// while other threads create maps.
+void hrtxPipelineStatistics(HrtxPipeline hrtxPipeline, HrtxPipelineStatistics* statistics);
+
+// For maps with a subdivision level above 5, writes the vertex and index
+// inputs of the pre-tessellated triangles into *triangles, i.e. vertexFormat,
+// vertexData, vertexStride, maxVertex, indexType and indexData, as well as the
+// new primitive count. Other members are unchanged. These replace the
+// original triangles in the BVH build with hrtxMapDesc(). Returns VK_FALSE and
+// writes nothing for other maps.
+VkBool32 hrtxMapPretessellatedGeometry(HrtxMap                                          hrtxMap,
+                                       VkAccelerationStructureGeometryTrianglesDataKHR* triangles,
+                                       uint32_t*                                        primitiveCount);
+
+// First phase of map serialization, e.g. to cache baked maps on disk and skip
+// baking at startup. Records a copy of the micromap build inputs and per-vertex
+// bias and scale into host visible memory, kept by the map. These are in the
+// standard VK_NV_displacement_micromap formats, so the data can be loaded on
+// any device supporting the extension with the same library version. Must be
+// recorded before hrtxMapReleaseBakeResources(), unless the map was created
+// with HRTX_MAP_CREATE_ALLOW_UPDATE_BIT, and after any hrtxCmdUpdateMap() to
+// include. Only LOD 0 of maps with HrtxMapCreate::lodCount is serialized, so
+// maps loaded from the data have no coarser levels of detail. Returns
+// VK_ERROR_FEATURE_NOT_PRESENT for maps with a subdivision
+// level above 5 or without HrtxAllocatorCallbacks::mapBuffer, and
+// VK_ERROR_INITIALIZATION_FAILED if the map is waiting for hrtxCmdBuildMaps()
+// or its bake resources were released.
+VkResult hrtxCmdSerializeMap(VkCommandBuffer cmd, HrtxPipeline hrtxPipeline, HrtxMap hrtxMap);
+
+// Second phase of map serialization, once the command buffer passed to
+// hrtxCmdSerializeMap() has completed. If data is NULL, writes the size of the
+// serialized data to *dataSize. Otherwise copies it to data, which must hold
+// *dataSize bytes, and frees the map's copy. Returns VK_INCOMPLETE and writes
+// nothing if *dataSize is too small, and VK_ERROR_INITIALIZATION_FAILED if no
+// serialization was recorded.
+VkResult hrtxMapSerializedData(HrtxMap hrtxMap, size_t* dataSize, void* data);
+
+// Creates a map from hrtxMapSerializedData() output instead of baking it,
+// recording only uploads and the micromap build. The library cannot identify
+// the contents of the input buffers or heightmap, so the application must key
+// the data by its own asset identity. create must match the create info of the
+// serialized map, except that the heightmap is not read and may be null, and
+// the input buffers are only read by hrtxCmdUpdateMap(). Data for different
+// subdivision levels, flags, bounds or primitive counts, or from another
+// library version, is detected and VK_ERROR_FORMAT_NOT_SUPPORTED is returned,
+// in which case the map should be baked again. Loaded maps cannot be
+// compacted. Bake resources are released as for hrtxCmdCreateMap().
+VkResult hrtxCmdCreateMapFromSerializedData(VkCommandBuffer      cmd,
+                                            HrtxPipeline         hrtxPipeline,
+                                            const HrtxMapCreate* create,
+                                            size_t               dataSize,
+                                            const void*          data,
+                                            HrtxMap*             hrtxMap);
+
+// Variant of hrtxCmdCreateMapFromSerializedData() that copies the device data
+// from a buffer, e.g. a staging ring that map data is streamed into from an
+// archive. data and dataSize cover just the header and usages, i.e. an entry's
+// hostDataSize, and the HrtxMapArchiveEntry::deviceDataSize bytes following
+// them are read from deviceDataBuffer at deviceDataOffset. The buffer needs
+// VK_BUFFER_USAGE_TRANSFER_SRC_BIT and, like the host data, must remain valid
+// until the command buffer completes. Does not require
+// HrtxAllocatorCallbacks::mapBuffer.
+VkResult hrtxCmdCreateMapFromSerializedBuffer(VkCommandBuffer      cmd,
+                                              HrtxPipeline         hrtxPipeline,
+                                              const HrtxMapCreate* create,
+                                              size_t               dataSize,
+                                              const void*          data,
+                                              VkBuffer             deviceDataBuffer,
+                                              VkDeviceSize         deviceDataOffset,
+                                              HrtxMap*             hrtxMap);
+
+// File format for many serialized maps, e.g. one archive per terrain tile
+// that is memory mapped and paged in with the tile. The header is followed by
+// entryCount entries and then each map's hrtxMapSerializedData() output. Each
+// map's device data, after its header and usages, starts at a multiple of
+// deviceDataAlignment so it can be copied to a staging buffer with the same
+// alignment. All values are in the writing machine's byte order.
+typedef struct HrtxMapArchiveHeader
+{
+  uint32_t magic;
+  uint32_t version;
+  uint32_t entryCount;
+  uint32_t deviceDataAlignment;
+} HrtxMapArchiveHeader;
+
+typedef struct HrtxMapArchiveEntry
+{
+  uint64_t key;             // application defined, e.g. an asset hash
+  uint64_t offset;          // of the serialized map from the start of the archive
+  uint64_t hostDataSize;    // header and usages, passed as data
+  uint64_t deviceDataSize;  // build inputs following them, read by the device
+} HrtxMapArchiveEntry;
+
+// Writes an archive of mapCount serialized maps, each from
+// hrtxMapSerializedData() with the given dataSizes and keys. If archive is
+// NULL, writes the archive size to *archiveSize. Otherwise writes the archive,
+// which must hold *archiveSize bytes. Returns VK_INCOMPLETE and writes nothing
+// if *archiveSize is too small, and VK_ERROR_FORMAT_NOT_SUPPORTED if any data
+// is not a serialized map.
+VkResult hrtxMapArchiveWrite(uint32_t           mapCount,
+                             const uint64_t*    keys,
+                             const size_t*      dataSizes,
+                             const void* const* data,
+                             size_t*            archiveSize,
+                             void*              archive);
+
+// Reads the entries of an archive, checking they are within archiveSize
+// bytes. If entries is NULL, writes the number of entries to *entryCount.
+// Otherwise copies up to *entryCount entries and returns VK_INCOMPLETE if not
+// all were copied, as for Vulkan enumeration functions. Returns
+// VK_ERROR_FORMAT_NOT_SUPPORTED if the archive is invalid or from another
+// library version. A map is then created with
+// hrtxCmdCreateMapFromSerializedData(), passing hostDataSize + deviceDataSize
+// bytes at offset, or hrtxCmdCreateMapFromSerializedBuffer().
+VkResult hrtxMapArchiveEntries(size_t               archiveSize,
+                               const void*          archive,
+                               uint32_t*            entryCount,
+                               HrtxMapArchiveEntry* entries);
+
+typedef struct HrtxMapStatistics
+{
+  // Baked displacement of the map's LOD 0, from its per-level triangle counts.
+  // Vertices on edges shared between triangles are counted once per triangle.
+  uint64_t     microTriangleCount;
+  uint64_t     microVertexCount;
+  VkDeviceSize valuesSize;     // micromap build input values
+  VkDeviceSize trianglesSize;  // micromap build input triangles
+  VkDeviceSize micromapSize;   // after compaction, if that has been recorded
+
+  // GPU costs of the hrtxCmdCreateMaps() or hrtxCmdBuildMaps() batch the map
+  // was baked in, shared by its batchMapCount maps, e.g. to be divided by
+  // microTriangleCount. batchMapCount is zero for maps created from
+  // serialized data, and the costs are zero unless enabled by
+  // HrtxPipelineCreate::instrumentationFlags.
+  uint32_t batchMapCount;
+  uint64_t setupNanoseconds;          // input table uploads and clears
+  uint64_t compressNanoseconds;       // compress shader passes
+  uint64_t micromapBuildNanoseconds;  // vkCmdBuildMicromapsEXT() and compaction size queries
+  uint64_t compressInvocations;
+
+  // Device memory currently held by the map. Bake resources shared by a
+  // hrtxCmdCreateMaps() batch are counted in full by each of its maps until
+  // they are released, see HrtxPipelineStatistics for pipeline-wide totals.
+  VkDeviceSize micromapMemorySize;   // all levels of detail, including uncompacted and dynamic map micromaps
+  VkDeviceSize valuesMemorySize;     // build input values kept for updates or held by bake resources
+  VkDeviceSize trianglesMemorySize;  // build input triangles, likewise
+  VkDeviceSize scratchMemorySize;    // micromap build scratch
+  VkDeviceSize otherMemorySize;      // bias and scale, pre-tessellated geometry, shader inputs and readback
+
+  // Subdivision level and format histogram of LOD 0, valid until the map is
+  // next compacted, updated, re-baked or destroyed
+  uint32_t                  usageCount;
+  const VkMicromapUsageEXT* usages;
+} HrtxMapStatistics;
+
+// Writes the sizes and, if the pipeline was created with
+// instrumentationFlags, bake timings of hrtxMap to *statistics. Timings are
+// read from query pools kept with the bake resources, so with instrumentation
+// VK_NOT_READY is returned, with only the sizes and batchMapCount written, if
+// the bake commands have not yet completed or bake resources were already
+// released. Without instrumentation VK_SUCCESS is returned. Returns
+// VK_ERROR_INITIALIZATION_FAILED if the map is waiting for hrtxCmdBuildMaps().
+// Maps created from serialized data have no bake timings.
+VkResult hrtxMapStatistics(HrtxMap hrtxMap, HrtxMapStatistics* statistics);
+
 // See definition of HrtxMap for usage
 // NOTE: VK_PIPELINE_CREATE_RAY_TRACING_DISPLACEMENT_MICROMAP_BIT_NV must be set
 // on the raytracing pipeline
 VkAccelerationStructureTrianglesDisplacementMicromapNV hrtxMapDesc(HrtxMap hrtxMap);
 
+// hrtxMapDesc() for level of detail lod of a map created with
+// HrtxMapCreate::lodCount, where LOD 0 is the same as hrtxMapDesc(). lod is
+// clamped to the map's coarsest level of detail.
+VkAccelerationStructureTrianglesDisplacementMicromapNV hrtxMapLodDesc(HrtxMap hrtxMap, uint32_t lod);
+
 #ifdef __cplusplus
 }
 #endif
@@ -17,9 +17,15 @@
 
 // Computes the microvertex displacement along interpolated direction vectors.
 // Called in compress.comp before converting and storing the result in a
-// micromap. This would be the shader interface if glslang could compile extern
-// functions.
-float sampleHeight(sampler2D heightmap, uvec3 triangleIndices, vec3 baryCoord, vec2 textureCoord)
+// micromap, which clamps it to [0, 1]. Custom versions of this function are
+// compiled into their own compress shader, see README.md. triangleIndices and
+// baryCoord locate the microvertex on its base triangle, and userData is
+// HrtxMapCreate::sampleUserData, e.g. the address of a virtual texture page
+// table read with GL_EXT_buffer_reference. lod is the mip level matching the
+// microvertex spacing with HRTX_MAP_CREATE_FOOTPRINT_MIP_SAMPLING_BIT, and
+// otherwise zero, as implicit LOD texture() always samples mip 0 in compute.
+float sampleHeight(sampler2D heightmap, uvec3 triangleIndices, vec3 baryCoord, vec2 textureCoord, float lod,
+                   uint64_t userData)
 {
-  return texture(heightmap, textureCoord).x;
+  return textureLod(heightmap, textureCoord, lod).x;
 }
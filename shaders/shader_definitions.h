@@ -15,18 +15,114 @@
  * limitations under the License.
  */
 
-#define COMPRESS_WORKGROUP_SIZE 32
+// Used when HrtxPipelineCreate::compressWorkgroupSize is zero. Each workgroup
+// bakes one whole 64 byte compression block per thread, so that values can be
+// packed in shared memory and written without atomics. Every thread then
+// handles exactly as many microvertices as there are in a block.
+#define COMPRESS_DEFAULT_WORKGROUP_SIZE 32
+
+// Shared memory of the compress shader per thread, in 32 bit words: a block's
+// 45 displacements and 2 bounds, and a 31 word StagedTriangle
+#define COMPRESS_SHARED_WORDS_PER_THREAD 78
+
+// Specialization constant IDs of the compress shader
+#define COMPRESS_SPEC_WORKGROUP_SIZE 0
+#define COMPRESS_SPEC_SUBDIVISION_LEVEL 1
+#define COMPRESS_SPEC_PASS 2
+
+// Values of the COMPRESS_SPEC_PASS specialization constant
+#define COMPRESS_PASS_MAIN 0
+#define COMPRESS_PASS_BOUNDS 1
+#define COMPRESS_PASS_LEVELS 2
+#define COMPRESS_PASS_SELECT 3
+#define COMPRESS_PASS_LEVELS_DILATE 4
+#define COMPRESS_PASS_LEVELS_MIN 5
+#define COMPRESS_PASS_LEVELS_LIST 6
+
+// Number of subdivision levels with a list of triangles in the levels and
+// select passes
+#define COMPRESS_LEVEL_COUNT 6
+
+// Values of CompressGeometry::vertexTexCoordsFormat, for VK_FORMAT_R32G32_SFLOAT,
+// VK_FORMAT_R16G16_SFLOAT and VK_FORMAT_R16G16_UNORM
+#define COMPRESS_TEXCOORDS_FLOAT32 0
+#define COMPRESS_TEXCOORDS_FLOAT16 1
+#define COMPRESS_TEXCOORDS_UNORM16 2
+
+// Bits of CompressGeometry::flags, from HRTX_MAP_CREATE_SEAMLESS_EDGES_BIT and
+// HRTX_MAP_CREATE_FOOTPRINT_MIP_SAMPLING_BIT
+#define COMPRESS_FLAG_SEAMLESS_EDGES 1
+#define COMPRESS_FLAG_FOOTPRINT_LOD 2
 
 #define BINDING_COMPRESS_BIRD_TABLE 0
 #define BINDING_COMPRESS_HEIGHTMAP 1
 
-struct CompressPushConstants
+// Per-geometry inputs for baking a batch of maps with one dispatch per
+// subdivision level. Each geometry is baked by its own range of workgroups so
+// that all threads in a workgroup share the same geometry and heightmapIndex is
+// dynamically uniform. Index and texture coordinate formats are read
+// per geometry rather than specialized, as branching on them is uniform too.
+struct CompressGeometry
 {
   uint64_t vertexTexCoords;
   uint64_t triangleIndices;
   uint64_t baryValues;
   uint64_t baryTriangles;
-  uint32_t vertexTexCoordsStrideVec2;
+  uint64_t vertexBounds;        // per-vertex height bounds, if vertexBiasAndScale is set
+  uint64_t vertexBiasAndScale;  // per-vertex output for displacement bounds, or 0
+  uint64_t levelTriangles;      // triangle indices of this level, or 0 if all triangles have the same level
+  uint64_t levelCounts;         // per-level triangle counts, written by the levels and select passes, see isUpdate()
+  uint32_t vertexTexCoordsStrideWords;  // in 32 bit words
+  uint32_t triangleCount;  // of this level
+  uint32_t heightmapIndex;
+  uint32_t firstWorkgroup;
+  uint32_t dataOffset;           // byte offset of baryValues within the map's values
+  uint32_t maxSubdivisionLevel;  // for the levels pass
+  float    heightmapBias;
+  float    heightmapScale;
+  uint32_t triangleIndexBytes;     // 1, 2 or 4
+  uint32_t vertexTexCoordsFormat;  // COMPRESS_TEXCOORDS_*
+  uint64_t vertexDirections;             // R32G32B32_SFLOAT for COMPRESS_FLAG_SEAMLESS_EDGES length compensation, or 0
+  uint32_t vertexDirectionsStrideFloat;  // in floats
+  uint32_t flags;                        // COMPRESS_FLAG_*
+  uint64_t sampleUserData;               // passed to sampleHeight()
+  uint64_t triangleCountAddress;         // device-side count of the triangles to sample, at most triangleCount, or 0
+
+  // Inputs and outputs of the levels passes
+  uint64_t triangleLevels;  // per-triangle level
+  uint64_t vertexLevels;    // per-vertex highest and bitwise not of lowest level of the adjacent triangles
+  uint64_t primitiveFlags;  // per-triangle edge decimation bytes, packed into cleared 32 bit words
+};
+
+struct CompressPushConstants
+{
+  uint64_t geometries;  // CompressGeometry[geometryCount], sorted by firstWorkgroup
+  uint32_t geometryCount;
+  uint32_t workgroupCount;
+  float    updateRegion[4];  // texture coordinate min and max for the select pass
+};
+
+// Threads per workgroup of the tessellate shader, one per output vertex and
+// triangle
+#define TESSELLATE_WORKGROUP_SIZE 64
+
+// Inputs for pre-tessellating one map's triangles, splitting each into
+// segments^2 triangles with segments + 1 vertices along each edge. Vertices are
+// not shared between base triangles. Interpolated vertex attributes are written
+// tightly packed. Strides are in elements of the input's type.
+struct TessellatePushConstants
+{
+  uint64_t positions;
+  uint64_t texCoords;
+  uint64_t directions;
+  uint64_t triangleIndices;
+  uint64_t outPositions;
+  uint64_t outTexCoords;
+  uint64_t outDirections;
+  uint64_t outTriangleIndices;
+  uint32_t positionsStrideFloat;
+  uint32_t texCoordsStrideVec2;
+  uint32_t directionsStrideFloat;
   uint32_t triangleCount;
-  uint32_t subdivisionLevel;
+  uint32_t segments;
 };
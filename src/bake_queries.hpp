@@ -0,0 +1,136 @@
+/*
+ * SPDX-FileCopyrightText: Copyright (c) 2023 NVIDIA CORPORATION & AFFILIATES. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <vulkan/vulkan_core.h>
+#include <heightmap_rtx.h>
+#include <context.hpp>
+#include <vulkan_objects.hpp>
+#include <memory>
+
+// Optional GPU timestamps around the stages of a bake batch and a count of
+// compress shader invocations, enabled by HrtxPipelineCreate::
+// instrumentationFlags. Results are read by hrtxMapStatistics() once the
+// batch's command buffer has completed.
+class BakeQueries
+{
+public:
+  enum Timestamp
+  {
+    TimestampBegin,
+    TimestampSetup,
+    TimestampCompress,
+    TimestampMicromapBuild,
+    TimestampCount,
+  };
+
+  // Creates the query pools and records their reset, followed by the first
+  // timestamp
+  BakeQueries(VkCommandBuffer                  cmd,
+              const HrtxContext&               ctx,
+              HrtxPipelineInstrumentationFlags flags,
+              float                            timestampPeriod)
+      : m_ctx(ctx)
+      , m_timestampPeriod(timestampPeriod)
+  {
+    if(flags & HRTX_PIPELINE_INSTRUMENTATION_TIMESTAMPS_BIT)
+    {
+      m_timestamps = std::make_unique<QueryPool>(ctx, VK_QUERY_TYPE_TIMESTAMP, TimestampCount);
+      m_timestamps->cmdReset(cmd);
+    }
+    if(flags & HRTX_PIPELINE_INSTRUMENTATION_PIPELINE_STATISTICS_BIT)
+    {
+      m_statistics = std::make_unique<QueryPool>(ctx, VK_QUERY_TYPE_PIPELINE_STATISTICS, 1,
+                                                 VK_QUERY_PIPELINE_STATISTIC_COMPUTE_SHADER_INVOCATIONS_BIT);
+      m_statistics->cmdReset(cmd);
+    }
+
+    // Starts once prior work in the command buffer, e.g. pre-tessellation,
+    // has completed
+    cmdWriteTimestamp(cmd, TimestampBegin, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT);
+  }
+  BakeQueries(const BakeQueries& other)            = delete;
+  BakeQueries& operator=(const BakeQueries& other) = delete;
+
+  // Marks the end of a stage, once earlier commands have completed the given
+  // pipeline stage
+  void cmdWriteTimestamp(VkCommandBuffer cmd, Timestamp timestamp, VkPipelineStageFlags2 stage) const
+  {
+    if(m_timestamps)
+    {
+      m_ctx.vk.vkCmdWriteTimestamp2(cmd, stage, *m_timestamps, timestamp);
+    }
+  }
+
+  // Brackets the compress shader dispatches
+  void cmdBeginStatistics(VkCommandBuffer cmd) const
+  {
+    if(m_statistics)
+    {
+      m_ctx.vk.vkCmdBeginQuery(cmd, *m_statistics, 0, 0);
+    }
+  }
+  void cmdEndStatistics(VkCommandBuffer cmd) const
+  {
+    if(m_statistics)
+    {
+      m_ctx.vk.vkCmdEndQuery(cmd, *m_statistics, 0);
+    }
+  }
+
+  // Writes the batch's stage durations and invocation count. Members for
+  // queries that were not enabled are zero. Returns VK_NOT_READY if the
+  // commands have not yet completed.
+  VkResult results(HrtxMapStatistics* statistics) const
+  {
+    if(m_timestamps)
+    {
+      uint64_t ticks[TimestampCount]{};
+      VkResult result = m_ctx.vk.vkGetQueryPoolResults(m_ctx.device, *m_timestamps, 0, TimestampCount, sizeof(ticks),
+                                                       ticks, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+      if(result != VK_SUCCESS)
+      {
+        return result;
+      }
+      auto nanoseconds = [&](Timestamp end) {
+        return static_cast<uint64_t>(double(ticks[end] - ticks[end - 1]) * double(m_timestampPeriod));
+      };
+      statistics->setupNanoseconds         = nanoseconds(TimestampSetup);
+      statistics->compressNanoseconds      = nanoseconds(TimestampCompress);
+      statistics->micromapBuildNanoseconds = nanoseconds(TimestampMicromapBuild);
+    }
+    if(m_statistics)
+    {
+      uint64_t invocations = 0;
+      VkResult result      = m_ctx.vk.vkGetQueryPoolResults(m_ctx.device, *m_statistics, 0, 1, sizeof(invocations),
+                                                            &invocations, sizeof(invocations), VK_QUERY_RESULT_64_BIT);
+      if(result != VK_SUCCESS)
+      {
+        return result;
+      }
+      statistics->compressInvocations = invocations;
+    }
+    return VK_SUCCESS;
+  }
+
+private:
+  const HrtxContext&         m_ctx;
+  float                      m_timestampPeriod;  // nanoseconds per tick
+  std::unique_ptr<QueryPool> m_timestamps;
+  std::unique_ptr<QueryPool> m_statistics;
+};
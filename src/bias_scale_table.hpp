@@ -0,0 +1,145 @@
+/*
+ * SPDX-FileCopyrightText: Copyright (c) 2023 NVIDIA CORPORATION & AFFILIATES. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <vulkan/vulkan_core.h>
+#include <context.hpp>
+#include <vulkan_objects.hpp>
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Packed array of VK_FORMAT_R32G32_SFLOAT bias and scale pairs, one slot per
+// HrtxMap. Values are written to a host copy and uploaded by cmdUpload() with
+// one vkCmdUpdateBuffer() per run of consecutive slots. Pages are never
+// reallocated so slot addresses remain valid for the lifetime of a map. All
+// members are thread-safe.
+class BiasScaleTable
+{
+public:
+  static constexpr uint32_t slotsPerPage = 4096;
+
+  BiasScaleTable(const HrtxContext& ctx)
+      : m_ctx(ctx)
+  {
+  }
+  BiasScaleTable(const BiasScaleTable& other)            = delete;
+  BiasScaleTable& operator=(const BiasScaleTable& other) = delete;
+
+  uint32_t allocate()
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if(m_freeSlots.empty())
+    {
+      uint32_t firstSlot = static_cast<uint32_t>(m_pages.size()) * slotsPerPage;
+      m_pages.push_back(std::make_unique<Page>(m_ctx));
+      for(uint32_t i = slotsPerPage; i > 0; --i)
+      {
+        m_freeSlots.push_back(firstSlot + i - 1);
+      }
+    }
+    uint32_t slot = m_freeSlots.back();
+    m_freeSlots.pop_back();
+    return slot;
+  }
+  void free(uint32_t slot)
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_freeSlots.push_back(slot);
+  }
+
+  void set(uint32_t slot, float bias, float scale)
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    Page&                       page  = *m_pages[slot / slotsPerPage];
+    uint32_t                    index = slot % slotsPerPage;
+    page.values[index * 2 + 0]        = bias;
+    page.values[index * 2 + 1]        = scale;
+  }
+
+  VkDeviceAddress address(uint32_t slot) const
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    const Page&                 page = *m_pages[slot / slotsPerPage];
+    return page.address + (slot % slotsPerPage) * sizeof(float) * 2;
+  }
+  VkDescriptorBufferInfo descriptor(uint32_t slot) const
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    const Page&                 page = *m_pages[slot / slotsPerPage];
+    return {page.buffer, (slot % slotsPerPage) * sizeof(float) * 2, sizeof(float) * 2};
+  }
+
+  void statistics(HrtxPipelineStatistics* statistics) const
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    statistics->biasScaleSlotCount  = static_cast<uint32_t>(m_pages.size()) * slotsPerPage;
+    statistics->biasScaleSlotsInUse = statistics->biasScaleSlotCount - static_cast<uint32_t>(m_freeSlots.size());
+    statistics->biasScaleTableSize  = VkDeviceSize(statistics->biasScaleSlotCount) * sizeof(float) * 2;
+  }
+
+  // Uploads the current values of the given slots. Only the caller's slots
+  // are written so that each command buffer carries the values it depends on,
+  // regardless of the order other threads' commands are submitted in.
+  // vkCmdUpdateBuffer() is treated as a "transfer" operation. Returns false if
+  // there was nothing to write.
+  bool cmdUpload(VkCommandBuffer cmd, std::vector<uint32_t> slots) const
+  {
+    std::sort(slots.begin(), slots.end());
+    slots.erase(std::unique(slots.begin(), slots.end()), slots.end());
+    std::lock_guard<std::mutex> lock(m_mutex);
+    size_t first = 0;
+    while(first < slots.size())
+    {
+      // Extend the run while slots are consecutive and on the same page
+      size_t last = first + 1;
+      while(last < slots.size() && slots[last] == slots[last - 1] + 1 && slots[last] % slotsPerPage != 0)
+      {
+        ++last;
+      }
+      const Page&  page   = *m_pages[slots[first] / slotsPerPage];
+      uint32_t     index  = slots[first] % slotsPerPage;
+      VkDeviceSize offset = index * sizeof(float) * 2;
+      VkDeviceSize size   = (last - first) * sizeof(float) * 2;
+      m_ctx.vk.vkCmdUpdateBuffer(cmd, page.buffer, offset, size, &page.values[index * 2]);
+      first = last;
+    }
+    return !slots.empty();
+  }
+
+private:
+  struct Page
+  {
+    Page(const HrtxContext& ctx)
+        : buffer(ctx, slotsPerPage * sizeof(float) * 2, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT)
+        , address(buffer.address())
+    {
+    }
+    Buffer                              buffer;
+    VkDeviceAddress                     address;
+    std::array<float, slotsPerPage * 2> values{};
+  };
+
+  const HrtxContext&                 m_ctx;
+  mutable std::mutex                 m_mutex;
+  std::vector<std::unique_ptr<Page>> m_pages;
+  std::vector<uint32_t>              m_freeSlots;
+};
@@ -0,0 +1,232 @@
+/*
+ * SPDX-FileCopyrightText: Copyright (c) 2023 NVIDIA CORPORATION & AFFILIATES. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <vulkan/vulkan_core.h>
+#include <context.hpp>
+#include <vulkan_objects.hpp>
+#include <algorithm>
+#include <cassert>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+template <class T>
+constexpr T align_up(T x, T alignPOT) noexcept
+{
+  return (x + (alignPOT - 1)) & ~(alignPOT - 1);
+}
+
+// Suballocates aligned ranges from a few large buffers, rather than making an
+// allocator callback for every small buffer. All ranges share the same usage
+// flags and alignment. Freed ranges are reused by later allocations. Ranges may
+// be allocated, freed and accessed from multiple threads.
+class BufferArena
+{
+public:
+  struct Range
+  {
+    uint32_t     block;
+    VkDeviceSize offset;
+    VkDeviceSize size;
+  };
+
+  BufferArena(const HrtxContext& ctx, VkBufferUsageFlags usage, VkDeviceSize alignment, VkDeviceSize blockSize)
+      : m_ctx(ctx)
+      , m_usage(usage)
+      , m_alignment(alignment)
+      , m_blockSize(align_up(blockSize, alignment))
+  {
+    assert(alignment % 4 == 0 && "vkCmdFillBuffer() offsets must be a multiple of 4");
+  }
+  BufferArena(const BufferArena& other)            = delete;
+  BufferArena& operator=(const BufferArena& other) = delete;
+
+  // First-fit in existing blocks, otherwise adds a block big enough for size
+  Range allocate(VkDeviceSize size)
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    size = align_up(std::max(size, VkDeviceSize(1)), m_alignment);
+    for(uint32_t blockIndex = 0; blockIndex < m_blocks.size(); ++blockIndex)
+    {
+      std::unique_ptr<Block>& block = m_blocks[blockIndex];
+      if(!block)
+      {
+        continue;
+      }
+      for(auto it = block->freeRanges.begin(); it != block->freeRanges.end(); ++it)
+      {
+        if(it->second >= size)
+        {
+          Range result{blockIndex, it->first, size};
+          if(it->second > size)
+          {
+            block->freeRanges[it->first + size] = it->second - size;
+          }
+          block->freeRanges.erase(it);
+          return result;
+        }
+      }
+    }
+
+    // Reuse an empty block slot if there is one
+    uint32_t blockIndex = static_cast<uint32_t>(
+        std::find(m_blocks.begin(), m_blocks.end(), std::unique_ptr<Block>()) - m_blocks.begin());
+    if(blockIndex == m_blocks.size())
+    {
+      m_blocks.emplace_back();
+    }
+    VkDeviceSize blockSize = std::max(m_blockSize, size);
+    m_blocks[blockIndex]   = std::make_unique<Block>(m_ctx, blockSize, m_usage);
+    if(blockSize > size)
+    {
+      m_blocks[blockIndex]->freeRanges[size] = blockSize - size;
+    }
+    return Range{blockIndex, 0, size};
+  }
+
+  // Returns a range to its block, merging it with adjacent free ranges. Empty
+  // blocks are destroyed, except for the last one so that repeated bakes
+  // don't reallocate.
+  void free(const Range& range)
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    Block&                      block = *m_blocks[range.block];
+    auto                        it    = block.freeRanges.insert({range.offset, range.size}).first;
+    if(std::next(it) != block.freeRanges.end() && it->first + it->second == std::next(it)->first)
+    {
+      it->second += std::next(it)->second;
+      block.freeRanges.erase(std::next(it));
+    }
+    if(it != block.freeRanges.begin() && std::prev(it)->first + std::prev(it)->second == it->first)
+    {
+      std::prev(it)->second += it->second;
+      it = std::prev(block.freeRanges.erase(it));
+    }
+    bool empty = it->first == 0 && it->second == block.buffer.size();
+    if(empty && blockCount() > 1)
+    {
+      m_blocks[range.block].reset();
+    }
+  }
+
+  // Blocks are never moved, but m_blocks may be resized by another thread
+  const Buffer& buffer(const Range& range) const
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_blocks[range.block]->buffer;
+  }
+  VkDeviceAddress address(const Range& range) const
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_blocks[range.block]->address + range.offset;
+  }
+  VkDeviceSize       alignment() const { return m_alignment; }
+  const HrtxContext& ctx() const { return m_ctx; }
+
+  // Device memory of all blocks and the aligned ranges allocated from them
+  HrtxPipelineArenaStatistics statistics() const
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    HrtxPipelineArenaStatistics result{};
+    for(const std::unique_ptr<Block>& block : m_blocks)
+    {
+      if(!block)
+      {
+        continue;
+      }
+      ++result.blockCount;
+      result.blockSize += block->buffer.size();
+      result.allocatedSize += block->buffer.size();
+      for(const auto& freeRange : block->freeRanges)
+      {
+        result.allocatedSize -= freeRange.second;
+      }
+    }
+    return result;
+  }
+
+private:
+  struct Block
+  {
+    Block(const HrtxContext& ctx, VkDeviceSize size, VkBufferUsageFlags usage)
+        : buffer(ctx, size, usage)
+        , address((usage & VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT) ? buffer.address() : 0)
+    {
+    }
+    Buffer                               buffer;
+    VkDeviceAddress                      address;
+    std::map<VkDeviceSize, VkDeviceSize> freeRanges;  // offset to size
+  };
+
+  uint32_t blockCount() const
+  {
+    return static_cast<uint32_t>(std::count_if(m_blocks.begin(), m_blocks.end(),
+                                               [](const std::unique_ptr<Block>& block) { return block != nullptr; }));
+  }
+
+  const HrtxContext&                  m_ctx;
+  mutable std::mutex                  m_mutex;
+  VkBufferUsageFlags                  m_usage;
+  VkDeviceSize                        m_alignment;
+  VkDeviceSize                        m_blockSize;
+  std::vector<std::unique_ptr<Block>> m_blocks;
+};
+
+// A range allocated from a BufferArena, with a similar interface to Buffer.
+// The range is returned to the arena when destroyed.
+class ArenaBuffer
+{
+public:
+  ArenaBuffer(BufferArena& arena, VkDeviceSize size)
+      : m_arena(arena)
+      , m_range(arena.allocate(size))
+      , m_size(size)
+  {
+    assert(m_size % 4 == 0 && "vkCmdUpdateBuffer() size must be a multiple of 4");
+  }
+  ArenaBuffer(const ArenaBuffer& other)            = delete;
+  ArenaBuffer& operator=(const ArenaBuffer& other) = delete;
+  ~ArenaBuffer() noexcept { m_arena.free(m_range); }
+
+  VkBuffer               buffer() const { return m_arena.buffer(m_range); }
+  VkDeviceSize           offset() const { return m_range.offset; }
+  VkDeviceAddress        address() const { return m_arena.address(m_range); }
+  VkDeviceSize           size() const { return m_size; }
+  VkDescriptorBufferInfo descriptor() const { return {buffer(), offset(), m_size}; }
+  void update(VkCommandBuffer cmd, const void* data) const
+  {
+    // vkCmdUpdateBuffer() is limited to 65536 bytes per call
+    const VkDeviceSize maxUpdateSize = 65536;
+    for(VkDeviceSize offset = 0; offset < m_size; offset += maxUpdateSize)
+    {
+      m_arena.ctx().vk.vkCmdUpdateBuffer(cmd, buffer(), m_range.offset + offset, std::min(maxUpdateSize, m_size - offset),
+                                         static_cast<const char*>(data) + offset);
+    }
+  }
+  void clear(VkCommandBuffer cmd, uint32_t value = 0) const
+  {
+    m_arena.ctx().vk.vkCmdFillBuffer(cmd, buffer(), m_range.offset, m_size, value);
+  }
+
+private:
+  BufferArena&       m_arena;
+  BufferArena::Range m_range;
+  VkDeviceSize       m_size;
+};
@@ -24,20 +24,46 @@
 
 VkResult hrtxCreatePipeline(VkCommandBuffer cmd, const HrtxPipelineCreate* create, HrtxPipeline* hrtxPipeline)
 {
+  // SPIR-V is a sequence of 32 bit words
+  if(create->compressShaderCode
+     && (create->compressShaderCodeSize == 0 || create->compressShaderCodeSize % sizeof(uint32_t) != 0))
+  {
+    return VK_ERROR_INITIALIZATION_FAILED;
+  }
+
+  VkDeviceSize arenaBlockSize = create->arenaBlockSize ? create->arenaBlockSize : defaultArenaBlockSize;
   if(create->instance != VK_NULL_HANDLE || create->getInstanceProcAddr || create->getDeviceProcAddr)
   {
     *hrtxPipeline = new HrtxPipeline_T(cmd, create->instance, create->getInstanceProcAddr, create->physicalDevice,
                                        create->device, create->getDeviceProcAddr, create->allocator,
-                                       create->checkResultCallback, create->pipelineCache);
+                                       create->checkResultCallback, create->pipelineCache, arenaBlockSize,
+                                       create->compressWorkgroupSize, create->instrumentationFlags, create->flags,
+                                       create->bindlessHeightmapCount, create->compressShaderCode,
+                                       create->compressShaderCodeSize, create->pipelineCacheData,
+                                       create->pipelineCacheDataSize);
   }
   else
   {
     *hrtxPipeline = new HrtxPipeline_T(cmd, create->physicalDevice, create->device, create->allocator,
-                                       create->checkResultCallback, create->pipelineCache);
+                                       create->checkResultCallback, create->pipelineCache, arenaBlockSize,
+                                       create->compressWorkgroupSize, create->instrumentationFlags, create->flags,
+                                       create->bindlessHeightmapCount, create->compressShaderCode,
+                                       create->compressShaderCodeSize, create->pipelineCacheData,
+                                       create->pipelineCacheDataSize);
   }
   return VK_SUCCESS;
 }
 
+VkResult hrtxPipelineStatus(HrtxPipeline hrtxPipeline)
+{
+  return hrtxPipeline->pipelinesReady() ? VK_SUCCESS : VK_NOT_READY;
+}
+
+VkResult hrtxPipelineCacheData(HrtxPipeline hrtxPipeline, size_t* dataSize, void* data)
+{
+  return hrtxPipeline->pipelineCacheData(dataSize, data);
+}
+
 void hrtxDestroyPipeline(HrtxPipeline hrtxPipeline)
 {
   delete hrtxPipeline;
@@ -54,24 +80,69 @@ void hrtxBarrierFlags(VkPipelineStageFlags2* textureCoordsDstStageMask,
     *textureCoordsDstStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
   if(textureCoordsDstAccessMask)
     *textureCoordsDstAccessMask = VK_ACCESS_2_SHADER_READ_BIT;
+  // Pre-tessellation also reads directions in a compute shader
   if(directionsDstStageMask)
-    *directionsDstStageMask = VK_PIPELINE_STAGE_2_MICROMAP_BUILD_BIT_EXT;
+    *directionsDstStageMask = VK_PIPELINE_STAGE_2_MICROMAP_BUILD_BIT_EXT | VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
   if(directionsDstAccessMask)
-    *directionsDstAccessMask = VK_ACCESS_2_MICROMAP_READ_BIT_EXT;
+    *directionsDstAccessMask = VK_ACCESS_2_MICROMAP_READ_BIT_EXT | VK_ACCESS_2_SHADER_READ_BIT;
   if(heightmapLayout)
     *heightmapLayout = VK_IMAGE_LAYOUT_GENERAL;
 }
 
-VkResult hrtxCmdCreateMap(VkCommandBuffer cmd, HrtxPipeline hrtxPipeline, const HrtxMapCreate* create, HrtxMap* hrtxMap)
+void hrtxInputQueueFamilyTransferBarriers(HrtxQueueFamilyTransfer transfer,
+                                          uint32_t                srcQueueFamilyIndex,
+                                          uint32_t                dstQueueFamilyIndex,
+                                          VkBufferMemoryBarrier2* textureCoordsBarrier,
+                                          VkBufferMemoryBarrier2* directionsBarrier,
+                                          VkImageMemoryBarrier2*  heightmapBarrier)
 {
-  if(!hrtxPipeline)
+  // Destination stages are ignored by a release and source stages by an
+  // acquire, beyond the semaphore between them
+  bool                  release = transfer == HRTX_QUEUE_FAMILY_TRANSFER_RELEASE;
+  VkPipelineStageFlags2 textureCoordsStageMask, directionsStageMask;
+  VkAccessFlags2        textureCoordsAccessMask, directionsAccessMask;
+  VkImageLayout         heightmapLayout;
+  hrtxBarrierFlags(&textureCoordsStageMask, &textureCoordsAccessMask, &directionsStageMask, &directionsAccessMask, &heightmapLayout);
+  if(heightmapBarrier)
   {
-    return VK_ERROR_INITIALIZATION_FAILED;
+    heightmapBarrier->sType               = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2;
+    heightmapBarrier->srcQueueFamilyIndex = srcQueueFamilyIndex;
+    heightmapBarrier->dstQueueFamilyIndex = dstQueueFamilyIndex;
+    heightmapBarrier->newLayout           = heightmapLayout;
+    heightmapBarrier->dstStageMask        = release ? VK_PIPELINE_STAGE_2_NONE : VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+    heightmapBarrier->dstAccessMask       = release ? VK_ACCESS_2_NONE : VK_ACCESS_2_SHADER_READ_BIT;
+    if(!release)
+    {
+      heightmapBarrier->srcStageMask  = VK_PIPELINE_STAGE_2_NONE;
+      heightmapBarrier->srcAccessMask = VK_ACCESS_2_NONE;
+    }
   }
+  auto fillBufferBarrier = [&](VkBufferMemoryBarrier2* barrier, VkPipelineStageFlags2 dstStageMask, VkAccessFlags2 dstAccessMask) {
+    if(!barrier)
+    {
+      return;
+    }
+    barrier->sType               = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER_2;
+    barrier->srcQueueFamilyIndex = srcQueueFamilyIndex;
+    barrier->dstQueueFamilyIndex = dstQueueFamilyIndex;
+    barrier->dstStageMask        = release ? VK_PIPELINE_STAGE_2_NONE : dstStageMask;
+    barrier->dstAccessMask       = release ? VK_ACCESS_2_NONE : dstAccessMask;
+    if(!release)
+    {
+      barrier->srcStageMask  = VK_PIPELINE_STAGE_2_NONE;
+      barrier->srcAccessMask = VK_ACCESS_2_NONE;
+    }
+  };
+  fillBufferBarrier(textureCoordsBarrier, textureCoordsStageMask, textureCoordsAccessMask);
+  fillBufferBarrier(directionsBarrier, directionsStageMask, directionsAccessMask);
+}
 
-  // TODO: add support for other formats
-  if(create->triangles->indexType != VK_INDEX_TYPE_UINT32 || create->textureCoordsFormat != VK_FORMAT_R32G32_SFLOAT
-     || create->textureCoordsStride % (sizeof(float) * 2) != 0)
+// Checks inputs supported when baking or loading a map
+static VkResult validateMapCreate(const HrtxPipeline_T& hrtxPipeline, const HrtxMapCreate* create)
+{
+  // Texture coordinates are read as 32 bit words
+  if(tightIndexStrideBytes(create->triangles->indexType) == 0
+     || compressTexCoordsFormat(create->textureCoordsFormat) == ~0U || create->textureCoordsStride % sizeof(uint32_t) != 0)
   {
     return VK_ERROR_FORMAT_NOT_SUPPORTED;
   }
@@ -81,8 +152,204 @@ VkResult hrtxCmdCreateMap(VkCommandBuffer cmd, HrtxPipeline hrtxPipeline, const
     return VK_INCOMPLETE;  // ??
   }
 
-  // TODO: passing 'cmd' to the constructor to fill it as a side-effect is a bit of a smell
-  *hrtxMap = new HrtxMap_T(cmd, *hrtxPipeline, *create);
+  if(create->subdivisionLevel > maxPretessellatedSubdivisionLevel)
+  {
+    return VK_ERROR_FORMAT_NOT_SUPPORTED;
+  }
+
+  // Pre-tessellation interpolates positions, directions and texture
+  // coordinates, and only reads 32 bit formats
+  if(create->subdivisionLevel > maxSubdivisionLevel
+     && (create->triangles->vertexFormat != VK_FORMAT_R32G32B32_SFLOAT || create->triangles->vertexStride % sizeof(float) != 0
+         || create->directionsFormat != VK_FORMAT_R32G32B32_SFLOAT || create->directionsStride % sizeof(float) != 0
+         || create->triangles->indexType != VK_INDEX_TYPE_UINT32
+         || create->textureCoordsFormat != VK_FORMAT_R32G32_SFLOAT || create->textureCoordsStride % (sizeof(float) * 2) != 0))
+  {
+    return VK_ERROR_FORMAT_NOT_SUPPORTED;
+  }
+
+  // Tessellated vertices and triangles are indexed with 32 bits
+  if(PretessellatedGeometry::tessellatedVertexCount(*create) > std::numeric_limits<uint32_t>::max()
+     || PretessellatedGeometry::tessellatedTriangleCount(*create) > std::numeric_limits<uint32_t>::max())
+  {
+    return VK_ERROR_TOO_MANY_OBJECTS;
+  }
+
+  // Direction lengths are compensated from 32 bit floats
+  if((create->flags & HRTX_MAP_CREATE_SEAMLESS_EDGES_BIT)
+     && (create->directionsFormat != VK_FORMAT_R32G32B32_SFLOAT || create->directionsStride % sizeof(float) != 0))
+  {
+    return VK_ERROR_FORMAT_NOT_SUPPORTED;
+  }
+
+  // Adaptive levels are matched across vertices shared by base triangles,
+  // which pre-tessellated triangles do not share
+  if((create->flags & HRTX_MAP_CREATE_ADAPTIVE_SUBDIVISION_BIT)
+     && (!hrtxPipeline.ctx().allocator.mapBuffer || create->subdivisionLevel > maxSubdivisionLevel))
+  {
+    return VK_ERROR_FEATURE_NOT_PRESENT;
+  }
+
+  // Offsets must keep indices aligned. Per-vertex bounds are stored from
+  // vertex 0 and would not match the user's vertex indices.
+  if(create->buildRange)
+  {
+    if(create->buildRange->primitiveOffset % tightIndexStrideBytes(create->triangles->indexType) != 0)
+    {
+      return VK_ERROR_FORMAT_NOT_SUPPORTED;
+    }
+    if(create->buildRange->firstVertex != 0 && (create->flags & HRTX_MAP_CREATE_DISPLACEMENT_BOUNDS_BIT))
+    {
+      return VK_ERROR_FEATURE_NOT_PRESENT;
+    }
+  }
+
+  // Adaptive levels and pre-tessellation size their outputs from every
+  // triangle's inputs
+  if(create->primitiveCountAddress
+     && ((create->flags & HRTX_MAP_CREATE_ADAPTIVE_SUBDIVISION_BIT) || create->subdivisionLevel > maxSubdivisionLevel))
+  {
+    return VK_ERROR_FEATURE_NOT_PRESENT;
+  }
+
+  // Updates would also need to refit the bounds of adjacent vertices
+  if((create->flags & HRTX_MAP_CREATE_ALLOW_UPDATE_BIT) && (create->flags & HRTX_MAP_CREATE_DISPLACEMENT_BOUNDS_BIT))
+  {
+    return VK_ERROR_FEATURE_NOT_PRESENT;
+  }
+
+  // Coarser levels of detail are baked at uniform levels from the same inputs
+  // and are not updated
+  if(create->lodCount > 1
+     && ((create->flags & (HRTX_MAP_CREATE_ADAPTIVE_SUBDIVISION_BIT | HRTX_MAP_CREATE_ALLOW_UPDATE_BIT))
+         || create->subdivisionLevel > maxSubdivisionLevel))
+  {
+    return VK_ERROR_FEATURE_NOT_PRESENT;
+  }
+
+  // Re-bakes reuse the update inputs, and adaptive level lists are not kept
+  if((create->flags & HRTX_MAP_CREATE_DYNAMIC_BIT)
+     && (!(create->flags & HRTX_MAP_CREATE_ALLOW_UPDATE_BIT)
+         || (create->flags & HRTX_MAP_CREATE_ADAPTIVE_SUBDIVISION_BIT)))
+  {
+    return VK_ERROR_FEATURE_NOT_PRESENT;
+  }
+  return VK_SUCCESS;
+}
+
+VkResult hrtxCmdCreateMap(VkCommandBuffer cmd, HrtxPipeline hrtxPipeline, const HrtxMapCreate* create, HrtxMap* hrtxMap)
+{
+  return hrtxCmdCreateMaps(cmd, hrtxPipeline, 1, create, hrtxMap);
+}
+
+VkResult hrtxCmdCreateMaps(VkCommandBuffer      cmd,
+                           HrtxPipeline         hrtxPipeline,
+                           uint32_t             createCount,
+                           const HrtxMapCreate* creates,
+                           HrtxMap*             hrtxMaps)
+{
+  if(!hrtxPipeline)
+  {
+    return VK_ERROR_INITIALIZATION_FAILED;
+  }
+
+  // Nothing to record
+  if(createCount == 0)
+  {
+    return VK_SUCCESS;
+  }
+
+  HeightmapDescriptorInfos heightmaps;
+  for(uint32_t i = 0; i < createCount; ++i)
+  {
+    const HrtxMapCreate* create = &creates[i];
+    VkResult             result = validateMapCreate(*hrtxPipeline, create);
+    if(result != VK_SUCCESS)
+    {
+      return result;
+    }
+    heightmaps.indexOf(create->heightmapImage);
+  }
+
+  // All unique heightmaps in the batch are bound at once
+  HeightmapTablePin heightmapPin;
+  if(!hrtxPipeline->pinHeightmaps(heightmaps, heightmapPin))
+  {
+    return VK_ERROR_TOO_MANY_OBJECTS;
+  }
+
+  // Adaptive maps only record the pass computing their subdivision levels and
+  // are baked by hrtxCmdBuildMaps(). The rest are baked immediately.
+  std::vector<const HrtxMapCreate*> adaptiveCreates;
+  std::vector<const ArenaBuffer*>   adaptiveFlags;
+  std::vector<HrtxMap_T*>           adaptiveMaps;
+  std::vector<HrtxMap_T*>           immediateMaps;
+  bool                              pretessellated = false;
+  for(uint32_t i = 0; i < createCount; ++i)
+  {
+    hrtxMaps[i]   = new HrtxMap_T(*hrtxPipeline, creates[i]);
+    bool adaptive = (creates[i].flags & HRTX_MAP_CREATE_ADAPTIVE_SUBDIVISION_BIT) != 0;
+    (adaptive ? adaptiveMaps : immediateMaps).push_back(hrtxMaps[i]);
+    pretessellated = hrtxMaps[i]->cmdPretessellate(cmd, *hrtxPipeline) || pretessellated;
+    if(adaptive)
+    {
+      adaptiveCreates.push_back(&hrtxMaps[i]->pendingCreate());
+      adaptiveFlags.push_back(hrtxMaps[i]->primitiveFlags());
+    }
+  }
+
+  // Barrier between pre-tessellation and the passes reading its output
+  if(pretessellated)
+  {
+    memoryBarrier(cmd, hrtxPipeline->ctx(), VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+                  VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
+  }
+  if(!adaptiveMaps.empty())
+  {
+    auto adaptiveLevels = std::make_shared<const AdaptiveLevels>(cmd, *hrtxPipeline, adaptiveCreates, adaptiveFlags);
+    for(uint32_t i = 0; i < adaptiveMaps.size(); ++i)
+    {
+      adaptiveMaps[i]->setAdaptiveLevels(adaptiveLevels, i);
+    }
+  }
+  if(!immediateMaps.empty())
+  {
+    cmdBakeMaps(cmd, *hrtxPipeline, immediateMaps);
+  }
+  return VK_SUCCESS;
+}
+
+VkResult hrtxCmdBuildMaps(VkCommandBuffer cmd, HrtxPipeline hrtxPipeline, uint32_t mapCount, const HrtxMap* hrtxMaps)
+{
+  if(!hrtxPipeline)
+  {
+    return VK_ERROR_INITIALIZATION_FAILED;
+  }
+
+  HeightmapDescriptorInfos heightmaps;
+  std::vector<HrtxMap_T*>  maps;
+  for(uint32_t i = 0; i < mapCount; ++i)
+  {
+    if(!hrtxMaps[i]->pendingAdaptiveLevels())
+    {
+      return VK_ERROR_INITIALIZATION_FAILED;
+    }
+    if(!hrtxMaps[i]->adaptiveLevelsComplete())
+    {
+      return VK_NOT_READY;
+    }
+    heightmaps.indexOf(hrtxMaps[i]->bakeInput().create->heightmapImage);
+    maps.push_back(hrtxMaps[i]);
+  }
+  HeightmapTablePin heightmapPin;
+  if(!hrtxPipeline->pinHeightmaps(heightmaps, heightmapPin))
+  {
+    return VK_ERROR_TOO_MANY_OBJECTS;
+  }
+  if(!maps.empty())
+  {
+    cmdBakeMaps(cmd, *hrtxPipeline, maps);
+  }
   return VK_SUCCESS;
 }
 
@@ -91,7 +358,243 @@ void hrtxDestroyMap(HrtxMap hrtxMap)
   delete hrtxMap;
 }
 
+VkResult hrtxCmdMapsQueueFamilyTransfer(VkCommandBuffer         cmd,
+                                        HrtxPipeline            hrtxPipeline,
+                                        HrtxQueueFamilyTransfer transfer,
+                                        uint32_t                srcQueueFamilyIndex,
+                                        uint32_t                dstQueueFamilyIndex,
+                                        uint32_t                mapCount,
+                                        const HrtxMap*          hrtxMaps)
+{
+  if(!hrtxPipeline)
+  {
+    return VK_ERROR_INITIALIZATION_FAILED;
+  }
+
+  std::vector<HrtxMap_T*> maps;
+  for(uint32_t i = 0; i < mapCount; ++i)
+  {
+    if(hrtxMaps[i]->pendingBake())
+    {
+      return VK_ERROR_INITIALIZATION_FAILED;
+    }
+    maps.push_back(hrtxMaps[i]);
+  }
+  if(!maps.empty())
+  {
+    cmdMapsQueueFamilyTransfer(cmd, *hrtxPipeline, transfer, srcQueueFamilyIndex, dstQueueFamilyIndex, maps);
+  }
+  return VK_SUCCESS;
+}
+
+void hrtxCmdUpdateMapBiasScale(VkCommandBuffer cmd,
+                               HrtxPipeline    hrtxPipeline,
+                               uint32_t        mapCount,
+                               const HrtxMap*  hrtxMaps,
+                               const float*    biases,
+                               const float*    scales)
+{
+  std::vector<uint32_t> slots;
+  for(uint32_t i = 0; i < mapCount; ++i)
+  {
+    if(hrtxMaps[i]->setBiasScale(biases[i], scales[i]))
+    {
+      slots.push_back(hrtxMaps[i]->biasScaleSlot());
+    }
+  }
+
+  // Previous BVH builds may still be reading the old values
+  const HrtxContext& ctx = hrtxPipeline->ctx();
+  memoryBarrier2(cmd, ctx, VK_PIPELINE_STAGE_2_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, 0,
+                 VK_PIPELINE_STAGE_2_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT);
+  if(hrtxPipeline->biasScaleTable().cmdUpload(cmd, std::move(slots)))
+  {
+    memoryBarrier2(cmd, ctx, VK_PIPELINE_STAGE_2_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT,
+                   VK_PIPELINE_STAGE_2_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, VK_ACCESS_2_ACCELERATION_STRUCTURE_READ_BIT_KHR);
+  }
+}
+
+VkResult hrtxCmdUpdateMap(VkCommandBuffer cmd, HrtxPipeline hrtxPipeline, HrtxMap hrtxMap, const HrtxMapRegion* region)
+{
+  return hrtxMap->cmdUpdate(cmd, *hrtxPipeline, *region);
+}
+
+VkResult hrtxCmdRebakeMap(VkCommandBuffer cmd, HrtxPipeline hrtxPipeline, HrtxMap hrtxMap)
+{
+  return hrtxMap->cmdRebake(cmd, *hrtxPipeline);
+}
+
+void hrtxMapReleaseBakeResources(HrtxMap hrtxMap)
+{
+  hrtxMap->releaseBakeResources();
+}
+
+void hrtxPipelineMarkSubmitted(HrtxPipeline           hrtxPipeline,
+                               uint32_t               commandBufferCount,
+                               const VkCommandBuffer* commandBuffers,
+                               uint64_t               submitValue)
+{
+  hrtxPipeline->markTransientsSubmitted(commandBufferCount, commandBuffers, submitValue);
+}
+
+void hrtxPipelineReleaseBakeResources(HrtxPipeline hrtxPipeline, uint64_t completedValue)
+{
+  hrtxPipeline->releaseTransients(completedValue);
+}
+
+void hrtxPipelineStatistics(HrtxPipeline hrtxPipeline, HrtxPipelineStatistics* statistics)
+{
+  hrtxPipeline->statistics(statistics);
+}
+
+VkResult hrtxCmdCompactMap(VkCommandBuffer cmd, HrtxPipeline hrtxPipeline, HrtxMap hrtxMap)
+{
+  return hrtxMap->cmdCompact(cmd, *hrtxPipeline);
+}
+
+VkBool32 hrtxMapPretessellatedGeometry(HrtxMap                                          hrtxMap,
+                                       VkAccelerationStructureGeometryTrianglesDataKHR* triangles,
+                                       uint32_t*                                        primitiveCount)
+{
+  const PretessellatedGeometry* pretessellated = hrtxMap->pretessellated();
+  if(!pretessellated)
+  {
+    return VK_FALSE;
+  }
+  pretessellated->writeTriangles(*triangles);
+  *primitiveCount = pretessellated->triangleCount();
+  return VK_TRUE;
+}
+
+VkResult hrtxCmdSerializeMap(VkCommandBuffer cmd, HrtxPipeline hrtxPipeline, HrtxMap hrtxMap)
+{
+  return hrtxMap->cmdSerialize(cmd, *hrtxPipeline);
+}
+
+VkResult hrtxMapSerializedData(HrtxMap hrtxMap, size_t* dataSize, void* data)
+{
+  return hrtxMap->serializedData(dataSize, data);
+}
+
+// Shared by hrtxCmdCreateMapFromSerializedData() and
+// hrtxCmdCreateMapFromSerializedBuffer(). Device data is read from source if
+// it is not null.
+static VkResult cmdCreateMapFromSerialized(VkCommandBuffer      cmd,
+                                           HrtxPipeline         hrtxPipeline,
+                                           const HrtxMapCreate* create,
+                                           size_t               dataSize,
+                                           const void*          data,
+                                           VkBuffer             source,
+                                           VkDeviceSize         sourceOffset,
+                                           HrtxMap*             hrtxMap)
+{
+  if(!hrtxPipeline)
+  {
+    return VK_ERROR_INITIALIZATION_FAILED;
+  }
+  VkResult result = validateMapCreate(*hrtxPipeline, create);
+  if(result != VK_SUCCESS)
+  {
+    return result;
+  }
+
+  SerializedMapView view;
+  result = view.parse(*create, dataSize, data);
+  if(result != VK_SUCCESS)
+  {
+    return result;
+  }
+  if(!source && !view.deviceData)
+  {
+    return VK_ERROR_FORMAT_NOT_SUPPORTED;
+  }
+  // The staging buffer is written through HrtxAllocatorCallbacks::mapBuffer
+  if(!source && !hrtxPipeline->ctx().allocator.mapBuffer)
+  {
+    return VK_ERROR_FEATURE_NOT_PRESENT;
+  }
+
+  // Check the values match the usages before sizing anything from them
+  VkDeviceSize valuesSize = 0;
+  for(const VkMicromapUsageEXT& usage : view.usages)
+  {
+    if(usage.format != VK_DISPLACEMENT_MICROMAP_FORMAT_64_TRIANGLES_64_BYTES_NV)
+    {
+      return VK_ERROR_FORMAT_NOT_SUPPORTED;
+    }
+    valuesSize += usageValuesBytes(usage);
+  }
+  if(valuesSize != view.header.valuesSize)
+  {
+    return VK_ERROR_FORMAT_NOT_SUPPORTED;
+  }
+
+  *hrtxMap = new HrtxMap_T(*hrtxPipeline, *create);
+  (*hrtxMap)->cmdLoad(cmd, *hrtxPipeline, view, source, sourceOffset);
+  cmdFinishMaps(cmd, *hrtxPipeline, {*hrtxMap});
+  return VK_SUCCESS;
+}
+
+VkResult hrtxCmdCreateMapFromSerializedData(VkCommandBuffer      cmd,
+                                            HrtxPipeline         hrtxPipeline,
+                                            const HrtxMapCreate* create,
+                                            size_t               dataSize,
+                                            const void*          data,
+                                            HrtxMap*             hrtxMap)
+{
+  return cmdCreateMapFromSerialized(cmd, hrtxPipeline, create, dataSize, data, VK_NULL_HANDLE, 0, hrtxMap);
+}
+
+VkResult hrtxCmdCreateMapFromSerializedBuffer(VkCommandBuffer      cmd,
+                                              HrtxPipeline         hrtxPipeline,
+                                              const HrtxMapCreate* create,
+                                              size_t               dataSize,
+                                              const void*          data,
+                                              VkBuffer             deviceDataBuffer,
+                                              VkDeviceSize         deviceDataOffset,
+                                              HrtxMap*             hrtxMap)
+{
+  if(!deviceDataBuffer)
+  {
+    return VK_ERROR_INITIALIZATION_FAILED;
+  }
+  return cmdCreateMapFromSerialized(cmd, hrtxPipeline, create, dataSize, data, deviceDataBuffer, deviceDataOffset,
+                                    hrtxMap);
+}
+
+VkResult hrtxMapArchiveWrite(uint32_t           mapCount,
+                             const uint64_t*    keys,
+                             const size_t*      dataSizes,
+                             const void* const* data,
+                             size_t*            archiveSize,
+                             void*              archive)
+{
+  return writeMapArchive(mapCount, keys, dataSizes, data, archiveSize, archive);
+}
+
+VkResult hrtxMapArchiveEntries(size_t               archiveSize,
+                               const void*          archive,
+                               uint32_t*            entryCount,
+                               HrtxMapArchiveEntry* entries)
+{
+  return readMapArchiveEntries(archiveSize, archive, entryCount, entries);
+}
+
+VkResult hrtxMapStatistics(HrtxMap hrtxMap, HrtxMapStatistics* statistics)
+{
+  if(hrtxMap->pendingBake())
+  {
+    return VK_ERROR_INITIALIZATION_FAILED;
+  }
+  return hrtxMap->statistics(statistics);
+}
+
 VkAccelerationStructureTrianglesDisplacementMicromapNV hrtxMapDesc(HrtxMap hrtxMap)
 {
-  return hrtxMap->descriptor();
+  return hrtxMap->descriptor(0);
+}
+
+VkAccelerationStructureTrianglesDisplacementMicromapNV hrtxMapLodDesc(HrtxMap hrtxMap, uint32_t lod)
+{
+  return hrtxMap->descriptor(lod);
 }
@@ -0,0 +1,223 @@
+/*
+ * SPDX-FileCopyrightText: Copyright (c) 2023 NVIDIA CORPORATION & AFFILIATES. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <vulkan/vulkan_core.h>
+#include <context.hpp>
+#include <vulkan_bindings.hpp>
+#include <algorithm>
+#include <cassert>
+#include <mutex>
+#include <vector>
+#include "shader_definitions.h"
+
+// Default size of the heightmap array with
+// HRTX_PIPELINE_CREATE_BINDLESS_HEIGHTMAPS_BIT
+static constexpr uint32_t defaultBindlessHeightmapCount = 1024;
+
+// Returns the size of the update-after-bind heightmap array, i.e. the
+// requested count, or defaultBindlessHeightmapCount if zero, clamped to the
+// device limits
+inline uint32_t bindlessHeightmapCount(const HrtxContext& ctx, uint32_t requested)
+{
+  VkPhysicalDeviceDescriptorIndexingProperties indexingProps{};
+  indexingProps.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_PROPERTIES;
+  VkPhysicalDeviceProperties2 props2{
+      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
+      &indexingProps,
+      {},
+  };
+  ctx.vk.vkGetPhysicalDeviceProperties2(ctx.physicalDevice, &props2);
+  uint32_t maxCount = std::min({indexingProps.maxPerStageDescriptorUpdateAfterBindSamplers,
+                                indexingProps.maxPerStageDescriptorUpdateAfterBindSampledImages,
+                                indexingProps.maxDescriptorSetUpdateAfterBindSamplers,
+                                indexingProps.maxDescriptorSetUpdateAfterBindSampledImages});
+  return std::max(1U, std::min(requested ? requested : defaultBindlessHeightmapCount, maxCount));
+}
+
+// Pipeline-owned array of heightmap descriptors, bound once for all bakes
+// instead of allocating a descriptor pool and set per bake. Each unique
+// heightmap is written to a slot when first acquired, and the slot is reused
+// once its last reference is released. The binding is update-after-bind so
+// that free slots can be written while earlier bakes are still pending. Slots
+// are acquired and released under a lock, so bakes may be recorded on
+// multiple threads.
+class HeightmapTable
+{
+public:
+  HeightmapTable(const HrtxContext& ctx, uint32_t maxCount)
+      : m_ctx(ctx)
+      , m_bindings{DescriptorBindingAndFlags{
+            {
+                BINDING_COMPRESS_HEIGHTMAP,
+                VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+                maxCount,
+                VK_SHADER_STAGE_ALL,
+                nullptr,
+            },
+            VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT | VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT
+                | VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT,
+        }}
+      , m_layout(ctx,
+                 m_bindings,
+                 VkDescriptorSetLayoutCreateInfo{
+                     VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+                     nullptr,
+                     VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT,
+                     0,
+                     nullptr,
+                 })
+      , m_pool(ctx, m_bindings, 0, VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT)
+      , m_set(ctx, m_pool, m_layout)
+      , m_slots(maxCount)
+  {
+    for(uint32_t i = maxCount; i > 0; --i)
+    {
+      m_freeSlots.push_back(i - 1);
+    }
+  }
+  HeightmapTable(const HeightmapTable& other)            = delete;
+  HeightmapTable& operator=(const HeightmapTable& other) = delete;
+
+  // Returns the slot holding info, writing it to a free slot if it is not in
+  // the table
+  uint32_t acquire(const VkDescriptorImageInfo& info)
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    assert((find(info) != ~0U || !m_freeSlots.empty()) && "hold the heightmap with tryAcquire() first");
+    return acquireLocked(info);
+  }
+  void release(uint32_t slot)
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    assert(m_slots[slot].references > 0);
+    if(--m_slots[slot].references == 0)
+    {
+      m_freeSlots.push_back(slot);
+    }
+  }
+
+  // Acquires all of infos if there are enough free slots for those not
+  // already in the table, appending their slots to slots, otherwise acquires
+  // none and returns false. Checking and acquiring at once means another
+  // thread cannot take the free slots in between.
+  bool tryAcquire(const std::vector<VkDescriptorImageInfo>& infos, std::vector<uint32_t>& slots)
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto                        isMissing = [this](const VkDescriptorImageInfo& info) { return find(info) == ~0U; };
+    size_t                      missing   = std::count_if(infos.begin(), infos.end(), isMissing);
+    if(missing > m_freeSlots.size())
+    {
+      return false;
+    }
+    for(const VkDescriptorImageInfo& info : infos)
+    {
+      slots.push_back(acquireLocked(info));
+    }
+    return true;
+  }
+
+  const DescriptorSetLayout& layout() const { return m_layout; }
+  VkDescriptorSet            descriptorSet() const { return m_set; }
+
+  void statistics(HrtxPipelineStatistics* statistics) const
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    statistics->heightmapSlotCount  = static_cast<uint32_t>(m_slots.size());
+    statistics->heightmapSlotsInUse = static_cast<uint32_t>(m_slots.size() - m_freeSlots.size());
+  }
+
+private:
+  struct Slot
+  {
+    VkDescriptorImageInfo info{};
+    uint32_t              references = 0;
+  };
+
+  uint32_t acquireLocked(const VkDescriptorImageInfo& info)
+  {
+    uint32_t slot = find(info);
+    if(slot == ~0U)
+    {
+      slot = m_freeSlots.back();
+      m_freeSlots.pop_back();
+      m_slots[slot].info = info;
+      DescriptorSetWrites writes{VkWriteDescriptorSet{
+          VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+          nullptr,
+          m_set,
+          BINDING_COMPRESS_HEIGHTMAP,
+          slot,
+          1,
+          VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+          &m_slots[slot].info,
+          nullptr,
+          nullptr,
+      }};
+      updateDescriptorSets(m_ctx.device, writes);
+    }
+    ++m_slots[slot].references;
+    return slot;
+  }
+
+  uint32_t find(const VkDescriptorImageInfo& info) const
+  {
+    auto it = std::find_if(m_slots.begin(), m_slots.end(), [&info](const Slot& slot) {
+      return slot.references > 0 && slot.info.sampler == info.sampler && slot.info.imageView == info.imageView
+             && slot.info.imageLayout == info.imageLayout;
+    });
+    return it == m_slots.end() ? ~0U : static_cast<uint32_t>(it - m_slots.begin());
+  }
+
+  const HrtxContext&          m_ctx;
+  mutable std::mutex          m_mutex;
+  DescriptorSetLayoutBindings m_bindings;
+  DescriptorSetLayout         m_layout;
+  SingleDescriptorSetPool     m_pool;
+  DescriptorSet               m_set;
+  std::vector<Slot>           m_slots;
+  std::vector<uint32_t>       m_freeSlots;
+};
+
+// Heightmaps held in a HeightmapTable while a call records its bakes, so that
+// the bakes find them in the table even if other threads fill it in between
+class HeightmapTablePin
+{
+public:
+  HeightmapTablePin() = default;
+  ~HeightmapTablePin()
+  {
+    for(uint32_t slot : m_slots)
+    {
+      m_table->release(slot);
+    }
+  }
+  HeightmapTablePin(const HeightmapTablePin& other)            = delete;
+  HeightmapTablePin& operator=(const HeightmapTablePin& other) = delete;
+
+  bool acquire(HeightmapTable& table, const std::vector<VkDescriptorImageInfo>& infos)
+  {
+    assert(!m_table);
+    m_table = &table;
+    return table.tryAcquire(infos, m_slots);
+  }
+
+private:
+  HeightmapTable*       m_table = nullptr;
+  std::vector<uint32_t> m_slots;
+};
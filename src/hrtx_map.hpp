@@ -21,8 +21,14 @@
 #include <cstdint>
 #include <heightmap_rtx.h>
 #include <hrtx_pipeline.hpp>
+#include <bake_queries.hpp>
+#include <serialized_map.hpp>
 #include <context.hpp>
+#include <algorithm>
+#include <array>
+#include <cassert>
 #include <memory>
+#include <vector>
 #include <vulkan_objects.hpp>
 
 inline VkDeviceSize microVertsPerTriangle(uint32_t subdivisionLevel)
@@ -31,11 +37,21 @@ inline VkDeviceSize microVertsPerTriangle(uint32_t subdivisionLevel)
   return (microVertsPerEdge * (microVertsPerEdge + 1U)) / 2U;
 }
 
-inline VkDeviceSize baryLosslessBlocks(const HrtxMapCreate& create)
+// The compress shader writes the uncompressed
+// VK_DISPLACEMENT_MICROMAP_FORMAT_64_TRIANGLES_64_BYTES_NV format, whose
+// 64 byte blocks hold subdivision level 3. Triangles with a higher level are
+// split into 4^(level - 3) blocks.
+static constexpr VkDeviceSize displacementBlockBytes = 64;
+
+inline uint32_t displacementBlocksPerTriangle(uint32_t subdivisionLevel)
+{
+  return 1U << ((std::max(3U, subdivisionLevel) - 3U) * 2U);
+}
+
+// Size of the displacement values for usage.count triangles
+inline VkDeviceSize usageValuesBytes(const VkMicromapUsageEXT& usage)
 {
-  uint32_t micromap6464BlocksPerTriangle = 1U << ((std::max(3U, create.subdivisionLevel) - 3U) * 2U);
-  uint32_t micromapBlockCount            = create.primitiveCount * micromap6464BlocksPerTriangle;
-  return micromapBlockCount;
+  return VkDeviceSize(usage.count) * displacementBlocksPerTriangle(usage.subdivisionLevel) * displacementBlockBytes;
 }
 
 inline uint32_t tightIndexStrideBytes(VkIndexType type)
@@ -53,147 +69,777 @@ inline uint32_t tightIndexStrideBytes(VkIndexType type)
   }
 }
 
-template <class T>
-constexpr T align_up(T x, T alignPOT) noexcept
+// Value of CompressGeometry::vertexTexCoordsFormat for a texture coordinate
+// format, or ~0U if compress.comp cannot read it
+inline uint32_t compressTexCoordsFormat(VkFormat format)
+{
+  switch(format)
+  {
+    case VK_FORMAT_R32G32_SFLOAT:
+      return COMPRESS_TEXCOORDS_FLOAT32;
+    case VK_FORMAT_R16G16_SFLOAT:
+      return COMPRESS_TEXCOORDS_FLOAT16;
+    case VK_FORMAT_R16G16_UNORM:
+      return COMPRESS_TEXCOORDS_UNORM16;
+    default:
+      return ~0U;
+  }
+}
+
+// Value of CompressGeometry::flags for a map's create flags
+inline uint32_t compressFlags(HrtxMapCreateFlags flags)
 {
-  return (x + (alignPOT - 1)) & ~(alignPOT - 1);
+  return ((flags & HRTX_MAP_CREATE_SEAMLESS_EDGES_BIT) ? COMPRESS_FLAG_SEAMLESS_EDGES : 0U)
+         | ((flags & HRTX_MAP_CREATE_FOOTPRINT_MIP_SAMPLING_BIT) ? COMPRESS_FLAG_FOOTPRINT_LOD : 0U);
 }
 
-VkDeviceSize micromapScratchAlignment(const HrtxContext& ctx)
+// Unique heightmap descriptors, so that maps sharing a heightmap in a batch
+// also share a descriptor.
+class HeightmapDescriptorInfos : public std::vector<VkDescriptorImageInfo>
 {
-  // For each element of pInfos, its scratchData.deviceAddress member must: be
-  // a multiple of
-  // VkPhysicalDeviceAccelerationStructurePropertiesKHR::minAccelerationStructureScratchOffsetAlignment
-  VkPhysicalDeviceAccelerationStructurePropertiesKHR asProps{};
-  asProps.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_PROPERTIES_KHR;
-  VkPhysicalDeviceProperties2 props2{
-      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
-      &asProps,
-      {},
-  };
-  ctx.vk.vkGetPhysicalDeviceProperties2(ctx.physicalDevice, &props2);
-  VkDeviceSize scratchAlignment = asProps.minAccelerationStructureScratchOffsetAlignment;
-  return scratchAlignment;
+public:
+  uint32_t indexOf(const VkDescriptorImageInfo& info)
+  {
+    auto it = std::find_if(begin(), end(), [&info](const VkDescriptorImageInfo& other) {
+      return other.sampler == info.sampler && other.imageView == info.imageView && other.imageLayout == info.imageLayout;
+    });
+    if(it == end())
+    {
+      push_back(info);
+      return static_cast<uint32_t>(size() - 1);
+    }
+    return static_cast<uint32_t>(it - begin());
+  }
+};
+
+// Heightmaps bound by one bake. Each unique heightmap gets an index into the
+// compress shader's heightmap array, either a slot in the pipeline's
+// HeightmapTable, which is held until the bake is released, or an element of
+// a descriptor set allocated for the bake by write().
+class HeightmapBindings
+{
+public:
+  HeightmapBindings(HrtxPipeline_T& hrtxPipeline)
+      : m_hrtxPipeline(hrtxPipeline)
+      , m_table(hrtxPipeline.heightmapTable())
+  {
+  }
+  ~HeightmapBindings()
+  {
+    for(uint32_t slot : m_slots)
+    {
+      m_table->release(slot);
+    }
+  }
+  HeightmapBindings(const HeightmapBindings& other)            = delete;
+  HeightmapBindings& operator=(const HeightmapBindings& other) = delete;
+
+  uint32_t indexOf(const VkDescriptorImageInfo& info)
+  {
+    uint32_t index = m_infos.indexOf(info);
+    if(!m_table)
+    {
+      return index;
+    }
+    if(index == m_slots.size())
+    {
+      m_slots.push_back(m_table->acquire(info));
+    }
+    return m_slots[index];
+  }
+
+  // Creates the bake's descriptor set, if not using the pipeline's table.
+  // Must be called after the last indexOf().
+  void write()
+  {
+    if(!m_table)
+    {
+      m_descriptors = m_hrtxPipeline.createHeightmapDescriptors(m_infos);
+    }
+  }
+
+  operator VkDescriptorSet() const { return m_table ? m_table->descriptorSet() : VkDescriptorSet(*m_descriptors); }
+
+private:
+  const HrtxPipeline_T&                m_hrtxPipeline;
+  HeightmapTable*                      m_table;
+  HeightmapDescriptorInfos             m_infos;
+  std::vector<uint32_t>                m_slots;
+  std::unique_ptr<SingleDescriptorSet> m_descriptors;
+};
+
+using LevelCounts = std::array<uint32_t, maxSubdivisionLevel + 1>;
+
+// Inputs to bake one map. Triangles are grouped by subdivision level, either
+// all at HrtxMapCreate::subdivisionLevel, or with per-triangle levels from
+// AdaptiveLevels. In that case levelTriangles holds primitiveCount triangle
+// indices per level, of which the first levelCounts[level] are used.
+struct BakeInput
+{
+  const HrtxMapCreate* create;
+  LevelCounts          levelCounts;
+  VkDeviceAddress      levelTriangles;
+};
+
+inline BakeInput uniformBakeInput(const HrtxMapCreate& create)
+{
+  BakeInput result{&create, {}, 0};
+  result.levelCounts[create.subdivisionLevel] = create.primitiveCount;
+  return result;
 }
 
+// Location of one map's data within the shared BaryDataVk buffers, or its
+// own buffers for maps created with HRTX_MAP_CREATE_ALLOW_UPDATE_BIT. Values
+// are grouped by subdivision level.
+struct BaryGeometry
+{
+  bool                                              ownBuffers;
+  VkDeviceSize                                      valuesOffset;
+  VkDeviceSize                                      valuesBytes;
+  std::array<VkDeviceSize, maxSubdivisionLevel + 1> levelValuesOffsets;  // relative to valuesOffset
+  VkDeviceSize                                      trianglesOffset;
+  uint32_t                                          triangleCount;
+  std::vector<VkMicromapUsageEXT>                   usages;
+  VkDeviceAddress                                   valuesAddress;
+  VkDeviceAddress                                   trianglesAddress;
+};
+
+// Micromap build inputs kept by maps created with
+// HRTX_MAP_CREATE_ALLOW_UPDATE_BIT, so that regions can be re-baked
+struct UpdatableBaryData
+{
+  std::unique_ptr<ArenaBuffer> values;
+  std::unique_ptr<ArenaBuffer> triangles;
+};
+
+// Size of a buffer that may be null, for HrtxMapStatistics
+template <class BufferType>
+VkDeviceSize bufferSize(const std::unique_ptr<BufferType>& buffer)
+{
+  return buffer ? buffer->size() : 0;
+}
+
+inline void addMemorySize(HrtxMapStatistics* statistics, const UpdatableBaryData& data)
+{
+  statistics->valuesMemorySize += bufferSize(data.values);
+  statistics->trianglesMemorySize += bufferSize(data.triangles);
+}
+
+// Micromap build input data for a batch of maps. Values and triangles for all
+// maps are allocated together and filled with a single dispatch per
+// subdivision level.
 class BaryDataVk
 {
 public:
-  BaryDataVk(VkCommandBuffer cmd, const HrtxPipeline_T& hrtxPipeline, const HrtxMapCreate& create)
-      : m_heightmapDescriptors(hrtxPipeline.createHeightmapDescriptors(create.heightmapImage))
-      , m_triangleCount(create.primitiveCount)
-      , m_subdivisionLevel(create.subdivisionLevel)
-      , m_baryValues(hrtxPipeline.ctx(),
-                     baryLosslessBlocks(create) * 64,
-                     VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT
-                         | VK_BUFFER_USAGE_MICROMAP_BUILD_INPUT_READ_ONLY_BIT_EXT)
-      , m_baryTriangles(hrtxPipeline.ctx(),
-                        create.primitiveCount * sizeof(VkMicromapTriangleEXT),
-                        VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT
-                            | VK_BUFFER_USAGE_MICROMAP_BUILD_INPUT_READ_ONLY_BIT_EXT)
-  {
-    // Clear the displacements as the shader uses atomicOr()s to fill them.
-    m_baryValues.clear(cmd);
-    m_baryTriangles.clear(cmd);
+  BaryDataVk(VkCommandBuffer               cmd,
+             HrtxPipeline_T&               hrtxPipeline,
+             const std::vector<BakeInput>& inputs,
+             const BakeQueries*            queries)
+      : m_geometries(baryGeometries(inputs))
+      , m_baryValues(hrtxPipeline.bakeArena(), sharedBytes(m_geometries, &BaryGeometry::valuesOffset, valuesBytes))
+      , m_baryTriangles(hrtxPipeline.bakeArena(), sharedBytes(m_geometries, &BaryGeometry::trianglesOffset, trianglesBytes))
+      , m_updatableData(inputs.size())
+  {
+    for(uint32_t i = 0; i < m_geometries.size(); ++i)
+    {
+      BaryGeometry& geometry = m_geometries[i];
+      if(geometry.ownBuffers)
+      {
+        m_updatableData[i].values    = std::make_unique<ArenaBuffer>(hrtxPipeline.bakeArena(), valuesBytes(geometry));
+        m_updatableData[i].triangles = std::make_unique<ArenaBuffer>(hrtxPipeline.bakeArena(), trianglesBytes(geometry));
+      }
+      geometry.valuesAddress =
+          geometry.ownBuffers ? m_updatableData[i].values->address() : m_baryValues.address() + geometry.valuesOffset;
+      geometry.trianglesAddress =
+          geometry.ownBuffers ? m_updatableData[i].triangles->address() : m_baryTriangles.address() + geometry.trianglesOffset;
+    }
+
+    // Maps with displacement bounds get per-vertex bias and scale, which are
+    // kept by the map, and temporary per-vertex height bounds
+    uint32_t                  inputCount       = static_cast<uint32_t>(inputs.size());
+    VkDeviceSize              vertexBoundsSize = 0;
+    std::vector<VkDeviceSize> vertexBoundsOffsets(inputCount);
+    m_vertexBiasAndScale.resize(inputCount);
+    for(uint32_t i = 0; i < inputCount; ++i)
+    {
+      const HrtxMapCreate& create = *inputs[i].create;
+      if(create.flags & HRTX_MAP_CREATE_DISPLACEMENT_BOUNDS_BIT)
+      {
+        VkDeviceSize vertexCount = VkDeviceSize(create.triangles->maxVertex) + 1;
+        vertexBoundsOffsets[i]   = vertexBoundsSize;
+        vertexBoundsSize += vertexCount * sizeof(uint32_t) * 2;
+        m_vertexBiasAndScale[i] = std::make_unique<ArenaBuffer>(hrtxPipeline.vertexDataArena(), vertexCount * sizeof(float) * 2);
+      }
+    }
+    if(vertexBoundsSize)
+    {
+      m_vertexBounds = std::make_unique<ArenaBuffer>(hrtxPipeline.bakeArena(), vertexBoundsSize);
+    }
+
+    // Build the table of shader inputs for each geometry and level, grouped by
+    // subdivision level so that each level's variant of the compress shader is
+    // dispatched once for all its geometries. Within a level, geometries with
+    // bounds come first so that the bounds pass can be dispatched for just
+    // those. Each workgroup bakes workgroupSize() blocks of a single geometry.
+    struct LevelDispatch
+    {
+      uint32_t firstGeometry;
+      uint32_t geometryCount;
+      uint32_t workgroupCount;
+      uint32_t boundsGeometryCount;
+      uint32_t boundsWorkgroupCount;
+    };
+    m_heightmapDescriptors = std::make_unique<HeightmapBindings>(hrtxPipeline);
+
+    std::vector<shaders::CompressGeometry>             compressGeometries;
+    std::array<LevelDispatch, maxSubdivisionLevel + 1> dispatches{};
+    uint32_t                                           blocksPerWorkgroup = hrtxPipeline.workgroupSize();
+    for(uint32_t level = 0; level <= maxSubdivisionLevel; ++level)
+    {
+      LevelDispatch& dispatch = dispatches[level];
+      dispatch.firstGeometry  = static_cast<uint32_t>(compressGeometries.size());
+      for(bool withBounds : {true, false})
+      {
+        for(uint32_t i = 0; i < inputCount; ++i)
+        {
+          const BakeInput&     input  = inputs[i];
+          const HrtxMapCreate& create = *input.create;
+          if(input.levelCounts[level] == 0 || (m_vertexBiasAndScale[i] != nullptr) != withBounds)
+          {
+            continue;
+          }
+          assert(tightIndexStrideBytes(create.triangles->indexType) != 0);
+          assert(compressTexCoordsFormat(create.textureCoordsFormat) != ~0U);
+          assert(create.textureCoordsStride % sizeof(uint32_t) == 0);
+
+          VkDeviceSize levelValuesOffset = m_geometries[i].levelValuesOffsets[level];
+          uint32_t     levelBlockCount =
+              input.levelCounts[level] * displacementBlocksPerTriangle(level);
+          compressGeometries.push_back(shaders::CompressGeometry{
+              create.textureCoordsBuffer.deviceAddress,
+              create.triangles->indexData.deviceAddress,
+              m_geometries[i].valuesAddress + levelValuesOffset,
+              m_geometries[i].trianglesAddress,
+              withBounds ? m_vertexBounds->address() + vertexBoundsOffsets[i] : 0,
+              withBounds ? m_vertexBiasAndScale[i]->address() : 0,
+              input.levelTriangles ? input.levelTriangles + VkDeviceSize(level) * create.primitiveCount * sizeof(uint32_t) : 0,
+              0,
+              static_cast<uint32_t>(create.textureCoordsStride / sizeof(uint32_t)),
+              input.levelCounts[level],
+              m_heightmapDescriptors->indexOf(create.heightmapImage),
+              dispatch.workgroupCount,
+              static_cast<uint32_t>(levelValuesOffset),
+              create.subdivisionLevel,
+              create.heightmapBias,
+              create.heightmapScale,
+              tightIndexStrideBytes(create.triangles->indexType),
+              compressTexCoordsFormat(create.textureCoordsFormat),
+              (create.flags & HRTX_MAP_CREATE_SEAMLESS_EDGES_BIT) ? create.directionsBuffer.deviceAddress : 0,
+              static_cast<uint32_t>(create.directionsStride / sizeof(float)),
+              compressFlags(create.flags),
+              create.sampleUserData,
+              create.primitiveCountAddress,
+              0,
+              0,
+              0,
+          });
+          dispatch.workgroupCount += (levelBlockCount + blocksPerWorkgroup - 1) / blocksPerWorkgroup;
+        }
+        if(withBounds)
+        {
+          dispatch.boundsGeometryCount  = static_cast<uint32_t>(compressGeometries.size()) - dispatch.firstGeometry;
+          dispatch.boundsWorkgroupCount = dispatch.workgroupCount;
+        }
+      }
+      dispatch.geometryCount = static_cast<uint32_t>(compressGeometries.size()) - dispatch.firstGeometry;
+    }
+    m_heightmapDescriptors->write();
+    m_compressGeometries =
+        std::make_unique<ArenaBuffer>(hrtxPipeline.bakeArena(), compressGeometries.size() * sizeof(shaders::CompressGeometry));
+
+    // The shader writes every word of the values and triangles buffers once,
+    // so only the geometry table and initial bounds need writing before the
+    // dispatches.
+    m_compressGeometries->update(cmd, compressGeometries.data());
+    if(m_vertexBounds)
+    {
+      m_vertexBounds->clear(cmd, 0xFFFFFFFFU);
+    }
+    if(queries)
+    {
+      queries->cmdWriteTimestamp(cmd, BakeQueries::TimestampSetup, VK_PIPELINE_STAGE_2_TRANSFER_BIT);
+      queries->cmdBeginStatistics(cmd);
+    }
     memoryBarrier(cmd, hrtxPipeline.ctx(), VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
                   VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
 
-    assert(create.triangles->indexType == VK_INDEX_TYPE_UINT32);
-    assert(create.textureCoordsFormat == VK_FORMAT_R32G32_SFLOAT);
-    assert(create.textureCoordsStride % (sizeof(float) * 2) == 0);
-
-    shaders::CompressPushConstants pushConstants{create.textureCoordsBuffer.deviceAddress,
-                                                 create.triangles->indexData.deviceAddress,
-                                                 m_baryValues.address(),
-                                                 m_baryTriangles.address(),
-                                                 static_cast<uint32_t>(create.textureCoordsStride / (sizeof(float) * 2)),
-                                                 m_triangleCount,
-                                                 m_subdivisionLevel};
-
-    const int32_t microTrianglesPerBlock = 45;
-    int32_t       threadCount =
-        static_cast<int32_t>(m_subdivisionLevel > 3 ? microTrianglesPerBlock * baryLosslessBlocks(create) :
-                                                      m_triangleCount * microVertsPerTriangle(m_subdivisionLevel));
-    int32_t groupCount = (threadCount + COMPRESS_WORKGROUP_SIZE - 1) / COMPRESS_WORKGROUP_SIZE;
-    hrtxPipeline.bindAndDispatch(cmd, *m_heightmapDescriptors, pushConstants, groupCount);
+    for(uint32_t pass : {COMPRESS_PASS_BOUNDS, COMPRESS_PASS_MAIN})
+    {
+      for(uint32_t level = 0; level <= maxSubdivisionLevel; ++level)
+      {
+        const LevelDispatch& dispatch       = dispatches[level];
+        bool                 boundsPass     = pass == COMPRESS_PASS_BOUNDS;
+        uint32_t             geometryCount  = boundsPass ? dispatch.boundsGeometryCount : dispatch.geometryCount;
+        uint32_t             workgroupCount = boundsPass ? dispatch.boundsWorkgroupCount : dispatch.workgroupCount;
+        if(geometryCount == 0)
+        {
+          continue;
+        }
+        shaders::CompressPushConstants pushConstants{
+            m_compressGeometries->address() + dispatch.firstGeometry * sizeof(shaders::CompressGeometry),
+            geometryCount,
+            workgroupCount,
+            {},
+        };
+        hrtxPipeline.bindAndDispatch(cmd, *m_heightmapDescriptors, pushConstants, static_cast<int32_t>(workgroupCount),
+                                     level, pass);
+      }
+
+      // Barrier between the bounds pass and the main pass reading them
+      if(pass == COMPRESS_PASS_BOUNDS && m_vertexBounds)
+      {
+        memoryBarrier(cmd, hrtxPipeline.ctx(), VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+                      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
+      }
+    }
+
+    if(queries)
+    {
+      queries->cmdEndStatistics(cmd);
+      queries->cmdWriteTimestamp(cmd, BakeQueries::TimestampCompress, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT);
+    }
 
     // Barrier between the compute shader and vkCmdBuildMicromapsEXT().
     memoryBarrier2(cmd, hrtxPipeline.ctx(), VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_WRITE_BIT,
                    VK_PIPELINE_STAGE_2_MICROMAP_BUILD_BIT_EXT, VK_ACCESS_2_MICROMAP_READ_BIT_EXT);
   }
-  const Buffer& values() const { return m_baryValues; }
-  const Buffer& triangles() const { return m_baryTriangles; }
-  uint32_t      triangleCount() const { return m_triangleCount; }
-  uint32_t      subdivisionLevel() const { return m_subdivisionLevel; }
+
+  // Per-vertex bias and scale of a map with displacement bounds, or null.
+  // Ownership moves to the map, as it outlives the bake resources.
+  std::unique_ptr<ArenaBuffer> takeVertexBiasAndScale(uint32_t index) { return std::move(m_vertexBiasAndScale[index]); }
+  // Values and triangles of a map created with
+  // HRTX_MAP_CREATE_ALLOW_UPDATE_BIT, moved to the map in the same way
+  UpdatableBaryData   takeUpdatableData(uint32_t index) { return std::move(m_updatableData[index]); }
+  const BaryGeometry& geometry(uint32_t index) const { return m_geometries[index]; }
+  uint32_t            geometryCount() const { return static_cast<uint32_t>(m_geometries.size()); }
+
+  // Ranges of a map's values and triangles, if not taken by the map
+  VkDescriptorBufferInfo valuesDescriptor(uint32_t index) const
+  {
+    const BaryGeometry& geometry = m_geometries[index];
+    return {m_baryValues.buffer(), m_baryValues.offset() + geometry.valuesOffset, geometry.valuesBytes};
+  }
+  VkDescriptorBufferInfo trianglesDescriptor(uint32_t index) const
+  {
+    const BaryGeometry& geometry = m_geometries[index];
+    return {m_baryTriangles.buffer(), m_baryTriangles.offset() + geometry.trianglesOffset, trianglesBytes(geometry)};
+  }
+
+  // Shared buffers of the whole batch. Buffers taken by maps are counted by
+  // the maps.
+  void addMemorySize(HrtxMapStatistics* statistics) const
+  {
+    statistics->valuesMemorySize += m_baryValues.size();
+    statistics->trianglesMemorySize += m_baryTriangles.size();
+    statistics->otherMemorySize += bufferSize(m_compressGeometries) + bufferSize(m_vertexBounds);
+  }
 
   BaryDataVk(const BaryDataVk& other)            = delete;
   BaryDataVk& operator=(const BaryDataVk& other) = delete;
 
+private:
+  static std::vector<BaryGeometry> baryGeometries(const std::vector<BakeInput>& inputs)
+  {
+    std::vector<BaryGeometry> result;
+    VkDeviceSize              valuesOffset    = 0;
+    VkDeviceSize              trianglesOffset = 0;
+    for(const BakeInput& input : inputs)
+    {
+      bool         ownBuffers = (input.create->flags & HRTX_MAP_CREATE_ALLOW_UPDATE_BIT) != 0;
+      BaryGeometry geometry{ownBuffers, ownBuffers ? 0 : valuesOffset, 0, {}, ownBuffers ? 0 : trianglesOffset,
+                            input.create->primitiveCount, {}, 0, 0};
+      for(uint32_t level = 0; level <= maxSubdivisionLevel; ++level)
+      {
+        VkMicromapUsageEXT usage{input.levelCounts[level], level,
+                                 VK_DISPLACEMENT_MICROMAP_FORMAT_64_TRIANGLES_64_BYTES_NV};
+        geometry.levelValuesOffsets[level] = geometry.valuesBytes;
+        geometry.valuesBytes += usageValuesBytes(usage);
+        if(usage.count)
+        {
+          geometry.usages.push_back(usage);
+        }
+      }
+      if(!ownBuffers)
+      {
+        valuesOffset    = align_up(valuesOffset + valuesBytes(geometry), micromapBuildInputAlignment);
+        trianglesOffset = align_up(trianglesOffset + trianglesBytes(geometry), micromapBuildInputAlignment);
+      }
+      result.push_back(std::move(geometry));
+    }
+    return result;
+  }
+  static VkDeviceSize valuesBytes(const BaryGeometry& geometry) { return geometry.valuesBytes; }
+  static VkDeviceSize trianglesBytes(const BaryGeometry& geometry)
+  {
+    return geometry.triangleCount * sizeof(VkMicromapTriangleEXT);
+  }
+
+  // Size of a shared buffer, i.e. the end of the last geometry not in its own buffers
+  static VkDeviceSize sharedBytes(const std::vector<BaryGeometry>& geometries,
+                                  VkDeviceSize BaryGeometry::*     offset,
+                                  VkDeviceSize (*bytes)(const BaryGeometry&))
+  {
+    VkDeviceSize result = 0;
+    for(const BaryGeometry& geometry : geometries)
+    {
+      if(!geometry.ownBuffers)
+      {
+        result = std::max(result, geometry.*offset + bytes(geometry));
+      }
+    }
+    return result;
+  }
+
+  std::vector<BaryGeometry>            m_geometries;
+  ArenaBuffer                          m_baryValues;
+  ArenaBuffer                          m_baryTriangles;
+  std::unique_ptr<ArenaBuffer>         m_compressGeometries;
+  std::unique_ptr<ArenaBuffer>         m_vertexBounds;
+  std::unique_ptr<HeightmapBindings>   m_heightmapDescriptors;
+
+  std::vector<std::unique_ptr<ArenaBuffer>> m_vertexBiasAndScale;
+  std::vector<UpdatableBaryData>            m_updatableData;
+};
+
+// Per-triangle subdivision levels for a batch of maps created with
+// HRTX_MAP_CREATE_ADAPTIVE_SUBDIVISION_BIT. Compute passes choose each
+// triangle's level, raise levels until triangles sharing a vertex differ by at
+// most one, write the edge decimation flags of each map's primitiveFlags
+// buffer and sort the triangles into per-level lists and counts. The counts
+// are copied to host visible memory, from which the bake is sized once the
+// command buffer has completed. Kept alive by the maps waiting to be built and
+// then by their BakeBatch, which reads the level lists.
+class AdaptiveLevels
+{
 public:
-  std::unique_ptr<SingleDescriptorSet> m_heightmapDescriptors;
-  uint32_t                             m_triangleCount;
-  uint32_t                             m_subdivisionLevel;
-  Buffer                               m_baryValues;
-  Buffer                               m_baryTriangles;
+  AdaptiveLevels(VkCommandBuffer                          cmd,
+                 HrtxPipeline_T&                          hrtxPipeline,
+                 const std::vector<const HrtxMapCreate*>& creates,
+                 const std::vector<const ArenaBuffer*>&   primitiveFlags)
+  {
+    const HrtxContext&        ctx                = hrtxPipeline.ctx();
+    uint32_t                  createCount        = static_cast<uint32_t>(creates.size());
+    VkDeviceSize              countsSize         = createCount * sizeof(LevelCounts);
+    VkDeviceSize              trianglesSize      = 0;
+    VkDeviceSize              triangleLevelsSize = 0;
+    VkDeviceSize              vertexLevelsSize   = 0;
+    uint32_t                  maxLevel           = 0;
+    std::vector<VkDeviceSize> triangleLevelsOffsets;
+    std::vector<VkDeviceSize> vertexLevelsOffsets;
+    for(const HrtxMapCreate* create : creates)
+    {
+      m_levelTrianglesOffsets.push_back(trianglesSize);
+      trianglesSize += VkDeviceSize(create->primitiveCount) * (maxSubdivisionLevel + 1) * sizeof(uint32_t);
+      triangleLevelsOffsets.push_back(triangleLevelsSize);
+      triangleLevelsSize += VkDeviceSize(create->primitiveCount) * sizeof(uint32_t);
+      vertexLevelsOffsets.push_back(vertexLevelsSize);
+      vertexLevelsSize += (VkDeviceSize(create->triangles->maxVertex) + 1) * sizeof(uint32_t) * 2;
+      maxLevel = std::max(maxLevel, create->subdivisionLevel);
+    }
+    m_levelTriangles = std::make_unique<ArenaBuffer>(hrtxPipeline.bakeArena(), trianglesSize);
+    m_levelCounts    = std::make_unique<ArenaBuffer>(hrtxPipeline.bakeArena(), countsSize);
+    m_triangleLevels = std::make_unique<ArenaBuffer>(hrtxPipeline.bakeArena(), triangleLevelsSize);
+    m_vertexLevels   = std::make_unique<ArenaBuffer>(hrtxPipeline.bakeArena(), vertexLevelsSize);
+    m_readback       = std::make_unique<Buffer>(ctx, countsSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                                          VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    void* readbackData = m_readback->map();
+    assert(readbackData && "HrtxAllocatorCallbacks::mapBuffer is required");
+
+    // Zero counts until the copy has executed, see complete()
+    memset(readbackData, 0, countsSize);
+    m_readbackData = static_cast<const LevelCounts*>(readbackData);
+
+    m_heightmapDescriptors = std::make_unique<HeightmapBindings>(hrtxPipeline);
+
+    // One thread per triangle
+    std::vector<shaders::CompressGeometry> compressGeometries;
+    uint32_t                               workgroupCount = 0;
+    for(uint32_t i = 0; i < createCount; ++i)
+    {
+      const HrtxMapCreate& create = *creates[i];
+      compressGeometries.push_back(shaders::CompressGeometry{
+          create.textureCoordsBuffer.deviceAddress,
+          create.triangles->indexData.deviceAddress,
+          0,
+          0,
+          0,
+          0,
+          m_levelTriangles->address() + m_levelTrianglesOffsets[i],
+          m_levelCounts->address() + i * sizeof(LevelCounts),
+          static_cast<uint32_t>(create.textureCoordsStride / sizeof(uint32_t)),
+          create.primitiveCount,
+          m_heightmapDescriptors->indexOf(create.heightmapImage),
+          workgroupCount,
+          0,
+          create.subdivisionLevel,
+          create.heightmapBias,
+          create.heightmapScale,
+          tightIndexStrideBytes(create.triangles->indexType),
+          compressTexCoordsFormat(create.textureCoordsFormat),
+          (create.flags & HRTX_MAP_CREATE_SEAMLESS_EDGES_BIT) ? create.directionsBuffer.deviceAddress : 0,
+          static_cast<uint32_t>(create.directionsStride / sizeof(float)),
+          compressFlags(create.flags),
+          create.sampleUserData,
+          create.primitiveCountAddress,
+          m_triangleLevels->address() + triangleLevelsOffsets[i],
+          m_vertexLevels->address() + vertexLevelsOffsets[i],
+          primitiveFlags[i]->address(),
+      });
+      workgroupCount += (create.primitiveCount + hrtxPipeline.workgroupSize() - 1) / hrtxPipeline.workgroupSize();
+    }
+    m_heightmapDescriptors->write();
+    m_compressGeometries =
+        std::make_unique<ArenaBuffer>(hrtxPipeline.bakeArena(), compressGeometries.size() * sizeof(shaders::CompressGeometry));
+
+    m_compressGeometries->update(cmd, compressGeometries.data());
+    m_levelCounts->clear(cmd);
+    m_vertexLevels->clear(cmd);
+    for(const ArenaBuffer* flags : primitiveFlags)
+    {
+      flags->clear(cmd);
+    }
+    memoryBarrier(cmd, ctx, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+                  VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+
+    // Levels can rise by one per dilate pass starting from at most maxLevel,
+    // and level 0 next to level 1 needs none
+    std::vector<uint32_t> passes{COMPRESS_PASS_LEVELS};
+    for(uint32_t i = 1; i < maxLevel; ++i)
+    {
+      passes.push_back(COMPRESS_PASS_LEVELS_DILATE);
+    }
+    passes.push_back(COMPRESS_PASS_LEVELS_MIN);
+    passes.push_back(COMPRESS_PASS_LEVELS_LIST);
+
+    shaders::CompressPushConstants pushConstants{m_compressGeometries->address(), createCount, workgroupCount, {}};
+    for(size_t i = 0; i < passes.size(); ++i)
+    {
+      if(i > 0)
+      {
+        memoryBarrier(cmd, ctx, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+                      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+      }
+      hrtxPipeline.bindAndDispatch(cmd, *m_heightmapDescriptors, pushConstants, static_cast<int32_t>(workgroupCount), 0,
+                                   passes[i]);
+    }
+
+    // Read back the counts. The level lists stay on the device for the bake.
+    memoryBarrier(cmd, ctx, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+                  VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT);
+    VkBufferCopy region{m_levelCounts->offset(), 0, countsSize};
+    ctx.vk.vkCmdCopyBuffer(cmd, m_levelCounts->buffer(), *m_readback, 1, &region);
+    memoryBarrier(cmd, ctx, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT, VK_PIPELINE_STAGE_HOST_BIT,
+                  VK_ACCESS_HOST_READ_BIT);
+  }
+
+  // True once the counts of a map in the batch have been read back, i.e. they
+  // sum to its primitiveCount, which is never zero
+  bool complete(const HrtxMapCreate& create, uint32_t index) const
+  {
+    uint64_t count = 0;
+    for(uint32_t levelCount : m_readbackData[index])
+    {
+      count += levelCount;
+    }
+    return count == create.primitiveCount;
+  }
+
+  // Returns the bake inputs for a map in the batch. The command buffer must
+  // have completed execution.
+  BakeInput bakeInput(const HrtxMapCreate& create, uint32_t index) const
+  {
+    assert(complete(create, index) && "the levels pass must complete before hrtxCmdBuildMaps()");
+    return BakeInput{&create, m_readbackData[index], m_levelTriangles->address() + m_levelTrianglesOffsets[index]};
+  }
+
+  void addMemorySize(HrtxMapStatistics* statistics) const
+  {
+    statistics->otherMemorySize += bufferSize(m_levelTriangles) + bufferSize(m_levelCounts)
+                                   + bufferSize(m_triangleLevels) + bufferSize(m_vertexLevels)
+                                   + bufferSize(m_readback) + bufferSize(m_compressGeometries);
+  }
+
+  AdaptiveLevels(const AdaptiveLevels& other)            = delete;
+  AdaptiveLevels& operator=(const AdaptiveLevels& other) = delete;
+
+private:
+  std::vector<VkDeviceSize>            m_levelTrianglesOffsets;
+  std::unique_ptr<ArenaBuffer>         m_levelTriangles;
+  std::unique_ptr<ArenaBuffer>         m_levelCounts;
+  std::unique_ptr<ArenaBuffer>         m_triangleLevels;
+  std::unique_ptr<ArenaBuffer>         m_vertexLevels;
+  std::unique_ptr<Buffer>              m_readback;
+  const LevelCounts*                   m_readbackData = nullptr;
+  std::unique_ptr<ArenaBuffer>         m_compressGeometries;
+  std::unique_ptr<HeightmapBindings>   m_heightmapDescriptors;
+};
+
+// Geometry of a map with a subdivision level above maxSubdivisionLevel. Each
+// base triangle is split into 4^pretessellationLevel triangles on the GPU and
+// the map is baked from those at the remaining subdivision level. The user's
+// BVH is built from these buffers, see hrtxMapPretessellatedGeometry().
+class PretessellatedGeometry
+{
+public:
+  static uint32_t pretessellationLevel(uint32_t subdivisionLevel)
+  {
+    return subdivisionLevel > maxSubdivisionLevel ? subdivisionLevel - maxSubdivisionLevel : 0;
+  }
+
+  // Sizes of the tessellated geometry, which must fit in 32 bits, see
+  // validateMapCreate()
+  static uint64_t tessellatedVertexCount(const HrtxMapCreate& create)
+  {
+    uint64_t segments = 1ULL << pretessellationLevel(create.subdivisionLevel);
+    return uint64_t(create.primitiveCount) * (((segments + 1) * (segments + 2)) / 2);
+  }
+  static uint64_t tessellatedTriangleCount(const HrtxMapCreate& create)
+  {
+    return uint64_t(create.primitiveCount) << (2 * pretessellationLevel(create.subdivisionLevel));
+  }
+
+  PretessellatedGeometry(HrtxPipeline_T& hrtxPipeline, const HrtxMapCreate& create)
+      : m_segments(1U << pretessellationLevel(create.subdivisionLevel))
+      , m_vertexCount(static_cast<uint32_t>(tessellatedVertexCount(create)))
+      , m_triangleCount(static_cast<uint32_t>(tessellatedTriangleCount(create)))
+      , m_positions(hrtxPipeline.vertexDataArena(), VkDeviceSize(m_vertexCount) * sizeof(float) * 3)
+      , m_directions(hrtxPipeline.vertexDataArena(), VkDeviceSize(m_vertexCount) * sizeof(float) * 3)
+      , m_texCoords(hrtxPipeline.vertexDataArena(), VkDeviceSize(m_vertexCount) * sizeof(float) * 2)
+      , m_indices(hrtxPipeline.vertexDataArena(), VkDeviceSize(m_triangleCount) * sizeof(uint32_t) * 3)
+  {
+  }
+
+  // Records the tessellation of create's triangles. A compute barrier is needed
+  // before baking.
+  void cmdTessellate(VkCommandBuffer cmd, const HrtxPipeline_T& hrtxPipeline, const HrtxMapCreate& create) const
+  {
+    assert(create.triangles->vertexFormat == VK_FORMAT_R32G32B32_SFLOAT);
+    assert(create.directionsFormat == VK_FORMAT_R32G32B32_SFLOAT);
+    hrtxPipeline.tessellate(cmd, shaders::TessellatePushConstants{
+                                     create.triangles->vertexData.deviceAddress,
+                                     create.textureCoordsBuffer.deviceAddress,
+                                     create.directionsBuffer.deviceAddress,
+                                     create.triangles->indexData.deviceAddress,
+                                     m_positions.address(),
+                                     m_texCoords.address(),
+                                     m_directions.address(),
+                                     m_indices.address(),
+                                     static_cast<uint32_t>(create.triangles->vertexStride / sizeof(float)),
+                                     static_cast<uint32_t>(create.textureCoordsStride / (sizeof(float) * 2)),
+                                     static_cast<uint32_t>(create.directionsStride / sizeof(float)),
+                                     create.primitiveCount,
+                                     m_segments,
+                                 });
+  }
+
+  // Rewrites create to bake the tessellated triangles
+  void replaceInputs(HrtxMapCreate& create, VkAccelerationStructureGeometryTrianglesDataKHR& triangles) const
+  {
+    writeTriangles(triangles);
+    create.triangles                         = &triangles;
+    create.primitiveCount                    = m_triangleCount;
+    create.textureCoordsBuffer.deviceAddress = m_texCoords.address();
+    create.textureCoordsFormat               = VK_FORMAT_R32G32_SFLOAT;
+    create.textureCoordsStride               = sizeof(float) * 2;
+    create.directionsBuffer.deviceAddress    = m_directions.address();
+    create.directionsFormat                  = VK_FORMAT_R32G32B32_SFLOAT;
+    create.directionsStride                  = sizeof(float) * 3;
+    create.subdivisionLevel -= pretessellationLevel(create.subdivisionLevel);
+  }
+
+  // Replaces the vertex and index inputs of a BVH build's triangles
+  void writeTriangles(VkAccelerationStructureGeometryTrianglesDataKHR& triangles) const
+  {
+    triangles.vertexFormat             = VK_FORMAT_R32G32B32_SFLOAT;
+    triangles.vertexData.deviceAddress = m_positions.address();
+    triangles.vertexStride             = sizeof(float) * 3;
+    triangles.maxVertex                = m_vertexCount - 1;
+    triangles.indexType                = VK_INDEX_TYPE_UINT32;
+    triangles.indexData.deviceAddress  = m_indices.address();
+  }
+  uint32_t triangleCount() const { return m_triangleCount; }
+
+  // Buffers read by the user's BVH build
+  void appendBvhInputs(std::vector<VkDescriptorBufferInfo>& buffers) const
+  {
+    buffers.insert(buffers.end(), {m_positions.descriptor(), m_directions.descriptor(), m_indices.descriptor()});
+  }
+
+  void addMemorySize(HrtxMapStatistics* statistics) const
+  {
+    statistics->otherMemorySize += m_positions.size() + m_directions.size() + m_texCoords.size() + m_indices.size();
+  }
+
+  PretessellatedGeometry(const PretessellatedGeometry& other)            = delete;
+  PretessellatedGeometry& operator=(const PretessellatedGeometry& other) = delete;
+
+private:
+  uint32_t    m_segments;
+  uint32_t    m_vertexCount;
+  uint32_t    m_triangleCount;
+  ArenaBuffer m_positions;
+  ArenaBuffer m_directions;
+  ArenaBuffer m_texCoords;
+  ArenaBuffer m_indices;
 };
 
 class Micromap
 {
 public:
-  Micromap(const HrtxContext& ctx, VkDeviceSize size)
-      : m_ctx(ctx)
-      , m_data(ctx, size, VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_MICROMAP_STORAGE_BIT_EXT)
+  Micromap(BufferArena& micromapArena, VkDeviceSize size)
+      : m_ctx(micromapArena.ctx())
+      , m_data(micromapArena, size)
   {
     VkMicromapCreateInfoEXT mmCreateInfo = {
         VK_STRUCTURE_TYPE_MICROMAP_CREATE_INFO_EXT,
         nullptr,
         0,
-        m_data,
-        0,
+        m_data.buffer(),
+        m_data.offset(),
         m_data.size(),
         VK_MICROMAP_TYPE_DISPLACEMENT_MICROMAP_NV,
         0ull,  //
     };
-    ctx.checkResult(ctx.vk.vkCreateMicromapEXT(ctx.device, &mmCreateInfo, nullptr, &m_micromap));
+    m_ctx.checkResult(m_ctx.vk.vkCreateMicromapEXT(m_ctx.device, &mmCreateInfo, nullptr, &m_micromap));
   }
   ~Micromap() noexcept { m_ctx.vk.vkDestroyMicromapEXT(m_ctx.device, m_micromap, m_ctx.allocator.systemAllocator); }
   operator const VkMicromapEXT&() const { return m_micromap; }
+  VkDescriptorBufferInfo descriptor() const { return m_data.descriptor(); }
 
   Micromap(const Micromap& other)            = delete;
   Micromap& operator=(const Micromap& other) = delete;
 
 private:
   const HrtxContext& m_ctx;
-  Buffer             m_data;
+  ArenaBuffer        m_data;
   VkMicromapEXT      m_micromap;
 };
 
+// A micromap for one map, sized from its usages. The build is recorded
+// separately so that all maps in a batch are built with one
+// vkCmdBuildMicromapsEXT() call.
 class BuiltMicromap
 {
 public:
-  BuiltMicromap(VkCommandBuffer cmd, const HrtxContext& ctx, const BaryDataVk& baryDataVk)
+  BuiltMicromap(BufferArena& micromapArena, const std::vector<VkMicromapUsageEXT>& usages, bool allowCompaction)
+      : m_usages(usages)
+      , m_allowCompaction(allowCompaction)
   {
-    // One format for all triangles
-    m_usages.push_back(VkMicromapUsageEXT{baryDataVk.triangleCount(), baryDataVk.subdivisionLevel(),
-                                          VK_DISPLACEMENT_MICROMAP_FORMAT_64_TRIANGLES_64_BYTES_NV});
+    const HrtxContext& ctx = micromapArena.ctx();
 
     // Ask vulkan for the required micromap buffer sizes
-    VkMicromapBuildInfoEXT buildInfo{
-        VK_STRUCTURE_TYPE_MICROMAP_BUILD_INFO_EXT,
-        nullptr,
-        VK_MICROMAP_TYPE_DISPLACEMENT_MICROMAP_NV,
-        0,
-        VK_BUILD_MICROMAP_MODE_BUILD_EXT,
-        VK_NULL_HANDLE,
-        static_cast<uint32_t>(m_usages.size()),
-        m_usages.data(),
-        nullptr,
-        VkDeviceOrHostAddressConstKHR{0ull},
-        VkDeviceOrHostAddressKHR{0ull},
-        VkDeviceOrHostAddressConstKHR{0ull},
-        0ull,
-    };
-    VkMicromapBuildSizesInfoEXT sizeInfo = {
+    VkMicromapBuildInfoEXT      buildInfo = this->buildInfo(0, 0, 0);
+    VkMicromapBuildSizesInfoEXT sizeInfo  = {
         VK_STRUCTURE_TYPE_MICROMAP_BUILD_SIZES_INFO_EXT,
         nullptr,
         0ull,
@@ -203,90 +849,1356 @@ public:
     ctx.vk.vkGetMicromapBuildSizesEXT(ctx.device, VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR, &buildInfo, &sizeInfo);
     assert(sizeInfo.micromapSize && "sizeInfo.micromeshSize was zero");
 
-    m_micromap = std::make_unique<Micromap>(ctx, sizeInfo.micromapSize);
+    m_micromap = std::make_unique<Micromap>(micromapArena, sizeInfo.micromapSize);
 
     // The driver may use this
-    VkDeviceSize scratchSize = align_up(std::max(sizeInfo.buildScratchSize, VkDeviceSize(4)), micromapScratchAlignment(ctx));
-    m_micromapScratch        = std::make_unique<Buffer>(
-        ctx, scratchSize, VK_BUFFER_USAGE_MICROMAP_BUILD_INPUT_READ_ONLY_BIT_EXT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT);
-
-    // Build the micromap structure
-    buildInfo.dstMicromap                 = *m_micromap;
-    buildInfo.scratchData.deviceAddress   = m_micromapScratch->address();
-    buildInfo.data.deviceAddress          = baryDataVk.values().address();
-    buildInfo.triangleArray.deviceAddress = baryDataVk.triangles().address();
-    buildInfo.triangleArrayStride         = sizeof(VkMicromapTriangleEXT);
-    ctx.vk.vkCmdBuildMicromapsEXT(cmd, 1, &buildInfo);
-
-    memoryBarrier2(cmd, ctx, VK_PIPELINE_STAGE_2_MICROMAP_BUILD_BIT_EXT, VK_ACCESS_2_MICROMAP_WRITE_BIT_EXT,
-                   VK_PIPELINE_STAGE_2_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, VK_ACCESS_2_ACCELERATION_STRUCTURE_READ_BIT_KHR);
+    m_buildScratchSize = std::max(sizeInfo.buildScratchSize, VkDeviceSize(4));
   }
   const Micromap&                        micromap() const { return *m_micromap; }
   const std::vector<VkMicromapUsageEXT>& usages() const { return m_usages; }
+  VkDeviceSize                           buildScratchSize() const { return m_buildScratchSize; }
+  bool                                   allowCompaction() const { return m_allowCompaction; }
+  VkDeviceSize                           memorySize() const { return m_micromap->descriptor().range; }
+
+  // Records a copy of the micromap into a new one of exactly compactedSize
+  // bytes, which then replaces it. The original is returned as it must be
+  // kept alive until the copy completes.
+  std::unique_ptr<Micromap> cmdCompact(VkCommandBuffer cmd, BufferArena& micromapArena, VkDeviceSize compactedSize)
+  {
+    assert(m_allowCompaction);
+    auto                  compacted = std::make_unique<Micromap>(micromapArena, compactedSize);
+    VkCopyMicromapInfoEXT copyInfo{
+        VK_STRUCTURE_TYPE_COPY_MICROMAP_INFO_EXT,
+        nullptr,
+        *m_micromap,
+        *compacted,
+        VK_COPY_MICROMAP_MODE_COMPACT_EXT,
+    };
+    micromapArena.ctx().vk.vkCmdCopyMicromapEXT(cmd, &copyInfo);
+    std::swap(m_micromap, compacted);
+    return compacted;
+  }
+
+  // Returns the build info to build the micromap structure. Before the micromap
+  // is created, this is only valid for vkGetMicromapBuildSizesEXT().
+  VkMicromapBuildInfoEXT buildInfo(VkDeviceAddress scratch, VkDeviceAddress values, VkDeviceAddress triangles) const
+  {
+    return VkMicromapBuildInfoEXT{
+        VK_STRUCTURE_TYPE_MICROMAP_BUILD_INFO_EXT,
+        nullptr,
+        VK_MICROMAP_TYPE_DISPLACEMENT_MICROMAP_NV,
+        m_allowCompaction ? VkBuildMicromapFlagsEXT(VK_BUILD_MICROMAP_ALLOW_COMPACTION_BIT_EXT) : 0,
+        VK_BUILD_MICROMAP_MODE_BUILD_EXT,
+        m_micromap ? VkMicromapEXT(*m_micromap) : VK_NULL_HANDLE,
+        static_cast<uint32_t>(m_usages.size()),
+        m_usages.data(),
+        nullptr,
+        VkDeviceOrHostAddressConstKHR{values},
+        VkDeviceOrHostAddressKHR{scratch},
+        VkDeviceOrHostAddressConstKHR{triangles},
+        sizeof(VkMicromapTriangleEXT),
+    };
+  }
 
   BuiltMicromap(const BuiltMicromap& other)            = delete;
   BuiltMicromap& operator=(const BuiltMicromap& other) = delete;
 
 private:
-  // TODO: a lot of this could be freed after the command buffer is submitted,
-  // but there's no API. A cleanup thread with a fence might be inefficient
-  // and/or overkill.
   std::unique_ptr<Micromap>       m_micromap;
   std::vector<VkMicromapUsageEXT> m_usages;
-  std::unique_ptr<Buffer>         m_micromapScratch;
+  VkDeviceSize                    m_buildScratchSize = 0;
+  bool                            m_allowCompaction;
+};
+
+// The original micromaps of a map's levels of detail after compaction, kept
+// until the copies complete
+class UncompactedMicromap : public Transient
+{
+public:
+  UncompactedMicromap(std::vector<std::unique_ptr<Micromap>> micromaps)
+      : m_micromaps(std::move(micromaps))
+  {
+  }
+  void release() override { m_micromaps.clear(); }
+
+  void addMemorySize(HrtxMapStatistics* statistics) const
+  {
+    for(const std::unique_ptr<Micromap>& micromap : m_micromaps)
+    {
+      statistics->micromapMemorySize += micromap->descriptor().range;
+    }
+  }
+
+private:
+  std::vector<std::unique_ptr<Micromap>> m_micromaps;
+};
+
+// Transient resources to re-bake a region of a map created with
+// HRTX_MAP_CREATE_ALLOW_UPDATE_BIT. A select pass lists the triangles whose
+// texture coordinates overlap the region by their existing subdivision level
+// and sizes an indirect dispatch per level, which re-samples just those
+// triangles' blocks in place. Micromaps have no update mode, so the micromap
+// is then rebuilt from the map's values.
+class MapUpdate : public Transient
+{
+public:
+  MapUpdate(VkCommandBuffer      cmd,
+            HrtxPipeline_T&      hrtxPipeline,
+            const HrtxMapCreate& create,
+            const BuiltMicromap& builtMicromap,
+            VkDeviceAddress      values,
+            VkDeviceAddress      triangles,
+            const HrtxMapRegion& region)
+  {
+    const HrtxContext& ctx = hrtxPipeline.ctx();
+
+    // Per-level triangle counts followed by a VkDispatchIndirectCommand per level
+    struct Counts
+    {
+      LevelCounts                                                    levelCounts;
+      std::array<VkDispatchIndirectCommand, maxSubdivisionLevel + 1> dispatches;
+    };
+    Counts initialCounts{};
+    for(VkDispatchIndirectCommand& dispatch : initialCounts.dispatches)
+    {
+      dispatch = {0, 1, 1};
+    }
+    m_counts         = std::make_unique<ArenaBuffer>(hrtxPipeline.bakeArena(), sizeof(Counts));
+    VkDeviceSize levelTrianglesStride = VkDeviceSize(create.primitiveCount) * sizeof(uint32_t);
+    m_levelTriangles = std::make_unique<ArenaBuffer>(hrtxPipeline.bakeArena(), levelTrianglesStride * (maxSubdivisionLevel + 1));
+
+    m_heightmapDescriptors = std::make_unique<HeightmapBindings>(hrtxPipeline);
+
+    // The select pass, then one main pass per level the map has triangles in
+    std::vector<shaders::CompressGeometry> compressGeometries;
+    std::vector<uint32_t>                  levels;
+    shaders::CompressGeometry              geometry{
+        create.textureCoordsBuffer.deviceAddress,
+        create.triangles->indexData.deviceAddress,
+        values,
+        triangles,
+        0,
+        0,
+        m_levelTriangles->address(),
+        m_counts->address(),
+        static_cast<uint32_t>(create.textureCoordsStride / sizeof(uint32_t)),
+        create.primitiveCount,
+        m_heightmapDescriptors->indexOf(create.heightmapImage),
+        0,
+        0,
+        create.subdivisionLevel,
+        create.heightmapBias,
+        create.heightmapScale,
+        tightIndexStrideBytes(create.triangles->indexType),
+        compressTexCoordsFormat(create.textureCoordsFormat),
+        (create.flags & HRTX_MAP_CREATE_SEAMLESS_EDGES_BIT) ? create.directionsBuffer.deviceAddress : 0,
+        static_cast<uint32_t>(create.directionsStride / sizeof(float)),
+        compressFlags(create.flags),
+        create.sampleUserData,
+        create.primitiveCountAddress,
+        0,
+        0,
+        0,
+    };
+    compressGeometries.push_back(geometry);
+    for(const VkMicromapUsageEXT& usage : builtMicromap.usages())
+    {
+      geometry.levelTriangles = m_levelTriangles->address() + usage.subdivisionLevel * levelTrianglesStride;
+      compressGeometries.push_back(geometry);
+      levels.push_back(usage.subdivisionLevel);
+    }
+    m_heightmapDescriptors->write();
+    m_compressGeometries =
+        std::make_unique<ArenaBuffer>(hrtxPipeline.bakeArena(), compressGeometries.size() * sizeof(shaders::CompressGeometry));
+
+    // Previous micromap builds may still be reading the values
+    memoryBarrier2(cmd, ctx,
+                   VK_PIPELINE_STAGE_2_MICROMAP_BUILD_BIT_EXT | VK_PIPELINE_STAGE_2_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, 0,
+                   VK_PIPELINE_STAGE_2_TRANSFER_BIT | VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, 0);
+    m_compressGeometries->update(cmd, compressGeometries.data());
+    m_counts->update(cmd, &initialCounts);
+    memoryBarrier(cmd, ctx, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+                  VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+
+    uint32_t workgroupSize    = hrtxPipeline.workgroupSize();
+    uint32_t selectWorkgroups = (create.primitiveCount + workgroupSize - 1) / workgroupSize;
+    shaders::CompressPushConstants pushConstants{
+        m_compressGeometries->address(),
+        1,
+        selectWorkgroups,
+        {region.minU, region.minV, region.maxU, region.maxV},
+    };
+    hrtxPipeline.bindAndDispatch(cmd, *m_heightmapDescriptors, pushConstants, static_cast<int32_t>(selectWorkgroups), 0,
+                                 COMPRESS_PASS_SELECT);
+    memoryBarrier(cmd, ctx, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+                  VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                  VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_SHADER_READ_BIT);
+
+    for(uint32_t i = 0; i < levels.size(); ++i)
+    {
+      pushConstants.geometries = m_compressGeometries->address() + (i + 1) * sizeof(shaders::CompressGeometry);
+      hrtxPipeline.bindAndDispatchIndirect(cmd, *m_heightmapDescriptors, pushConstants, m_counts->buffer(),
+                                           m_counts->offset() + offsetof(Counts, dispatches)
+                                               + levels[i] * sizeof(VkDispatchIndirectCommand),
+                                           levels[i], COMPRESS_PASS_MAIN);
+    }
+
+    // Rebuild the micromap from all of the map's values
+    memoryBarrier2(cmd, ctx, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_WRITE_BIT,
+                   VK_PIPELINE_STAGE_2_MICROMAP_BUILD_BIT_EXT, VK_ACCESS_2_MICROMAP_READ_BIT_EXT);
+    BufferArena& scratchArena = hrtxPipeline.scratchArena();
+    m_micromapScratch =
+        std::make_unique<ArenaBuffer>(scratchArena, align_up(builtMicromap.buildScratchSize(), scratchArena.alignment()));
+    VkMicromapBuildInfoEXT buildInfo = builtMicromap.buildInfo(m_micromapScratch->address(), values, triangles);
+    ctx.vk.vkCmdBuildMicromapsEXT(cmd, 1, &buildInfo);
+
+    // Barrier between the build and reading the micromap in the user's BVH build
+    memoryBarrier2(cmd, ctx, VK_PIPELINE_STAGE_2_MICROMAP_BUILD_BIT_EXT, VK_ACCESS_2_MICROMAP_WRITE_BIT_EXT,
+                   VK_PIPELINE_STAGE_2_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, VK_ACCESS_2_ACCELERATION_STRUCTURE_READ_BIT_KHR);
+  }
+
+  bool released() const { return !m_counts; }
+  void release() override
+  {
+    m_counts.reset();
+    m_levelTriangles.reset();
+    m_compressGeometries.reset();
+    m_heightmapDescriptors.reset();
+    m_micromapScratch.reset();
+  }
+
+  void addMemorySize(HrtxMapStatistics* statistics) const
+  {
+    statistics->scratchMemorySize += bufferSize(m_micromapScratch);
+    statistics->otherMemorySize +=
+        bufferSize(m_counts) + bufferSize(m_levelTriangles) + bufferSize(m_compressGeometries);
+  }
+
+  MapUpdate(const MapUpdate& other)            = delete;
+  MapUpdate& operator=(const MapUpdate& other) = delete;
+
+private:
+  std::unique_ptr<ArenaBuffer>         m_counts;
+  std::unique_ptr<ArenaBuffer>         m_levelTriangles;
+  std::unique_ptr<ArenaBuffer>         m_compressGeometries;
+  std::unique_ptr<HeightmapBindings>   m_heightmapDescriptors;
+  std::unique_ptr<ArenaBuffer>         m_micromapScratch;
+};
+
+// Persistent resources to re-bake every triangle of a map created with
+// HRTX_MAP_CREATE_DYNAMIC_BIT, e.g. each frame from an animated heightmap.
+// Created by the first re-bake and kept by the map, so later re-bakes make no
+// allocations or descriptor writes. Values are overwritten in place, as only
+// the micromap build reads them, while the micromap is built into a given
+// target so that the map can alternate between two.
+class DynamicMapRebake
+{
+public:
+  DynamicMapRebake(VkCommandBuffer      cmd,
+                   HrtxPipeline_T&      hrtxPipeline,
+                   const HrtxMapCreate& create,
+                   const BuiltMicromap& builtMicromap,
+                   VkDeviceAddress      values,
+                   VkDeviceAddress      triangles)
+      : m_heightmapDescriptors(hrtxPipeline)
+      , m_compressGeometry(hrtxPipeline.bakeArena(), sizeof(shaders::CompressGeometry))
+      , m_micromapScratch(hrtxPipeline.scratchArena(),
+                          align_up(builtMicromap.buildScratchSize(), hrtxPipeline.scratchArena().alignment()))
+      , m_values(values)
+      , m_triangles(triangles)
+  {
+    // Without adaptive subdivision all triangles are at one level
+    assert(builtMicromap.usages().size() == 1);
+    const VkMicromapUsageEXT& usage             = builtMicromap.usages()[0];
+    uint32_t                  blocksPerTriangle = displacementBlocksPerTriangle(usage.subdivisionLevel);
+    uint32_t                  blockCount        = usage.count * blocksPerTriangle;
+    uint32_t                  workgroupSize     = hrtxPipeline.workgroupSize();
+    m_level                                     = usage.subdivisionLevel;
+    m_workgroupCount                            = (blockCount + workgroupSize - 1) / workgroupSize;
+
+    shaders::CompressGeometry geometry{
+        create.textureCoordsBuffer.deviceAddress,
+        create.triangles->indexData.deviceAddress,
+        values,
+        triangles,
+        0,
+        0,
+        0,
+        0,
+        static_cast<uint32_t>(create.textureCoordsStride / sizeof(uint32_t)),
+        usage.count,
+        m_heightmapDescriptors.indexOf(create.heightmapImage),
+        0,
+        0,
+        create.subdivisionLevel,
+        create.heightmapBias,
+        create.heightmapScale,
+        tightIndexStrideBytes(create.triangles->indexType),
+        compressTexCoordsFormat(create.textureCoordsFormat),
+        (create.flags & HRTX_MAP_CREATE_SEAMLESS_EDGES_BIT) ? create.directionsBuffer.deviceAddress : 0,
+        static_cast<uint32_t>(create.directionsStride / sizeof(float)),
+        compressFlags(create.flags),
+        create.sampleUserData,
+        create.primitiveCountAddress,
+        0,
+        0,
+        0,
+    };
+    m_heightmapDescriptors.write();
+
+    // Ordered before the first re-bake's dispatch by its initial barrier
+    m_compressGeometry.update(cmd, &geometry);
+  }
+
+  // Re-samples the map's values and builds them into target
+  void cmdRebake(VkCommandBuffer cmd, HrtxPipeline_T& hrtxPipeline, const BuiltMicromap& target) const
+  {
+    const HrtxContext& ctx = hrtxPipeline.ctx();
+
+    // Previous micromap builds may still be reading the values and using the
+    // scratch buffer
+    memoryBarrier2(cmd, ctx,
+                   VK_PIPELINE_STAGE_2_MICROMAP_BUILD_BIT_EXT | VK_PIPELINE_STAGE_2_ACCELERATION_STRUCTURE_BUILD_BIT_KHR
+                       | VK_PIPELINE_STAGE_2_TRANSFER_BIT,
+                   VK_ACCESS_2_MICROMAP_WRITE_BIT_EXT | VK_ACCESS_2_TRANSFER_WRITE_BIT,
+                   VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_2_MICROMAP_BUILD_BIT_EXT,
+                   VK_ACCESS_2_SHADER_READ_BIT | VK_ACCESS_2_MICROMAP_READ_BIT_EXT
+                       | VK_ACCESS_2_MICROMAP_WRITE_BIT_EXT);
+
+    shaders::CompressPushConstants pushConstants{
+        m_compressGeometry.address(),
+        1,
+        m_workgroupCount,
+        {},
+    };
+    hrtxPipeline.bindAndDispatch(cmd, m_heightmapDescriptors, pushConstants, static_cast<int32_t>(m_workgroupCount),
+                                 m_level, COMPRESS_PASS_MAIN);
+
+    memoryBarrier2(cmd, ctx, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_WRITE_BIT,
+                   VK_PIPELINE_STAGE_2_MICROMAP_BUILD_BIT_EXT, VK_ACCESS_2_MICROMAP_READ_BIT_EXT);
+    VkMicromapBuildInfoEXT buildInfo = target.buildInfo(m_micromapScratch.address(), m_values, m_triangles);
+    ctx.vk.vkCmdBuildMicromapsEXT(cmd, 1, &buildInfo);
+
+    // Barrier between the build and reading the micromap in the user's BVH build
+    memoryBarrier2(cmd, ctx, VK_PIPELINE_STAGE_2_MICROMAP_BUILD_BIT_EXT, VK_ACCESS_2_MICROMAP_WRITE_BIT_EXT,
+                   VK_PIPELINE_STAGE_2_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, VK_ACCESS_2_ACCELERATION_STRUCTURE_READ_BIT_KHR);
+  }
+
+  void addMemorySize(HrtxMapStatistics* statistics) const
+  {
+    statistics->scratchMemorySize += m_micromapScratch.size();
+    statistics->otherMemorySize += m_compressGeometry.size();
+  }
+
+  DynamicMapRebake(const DynamicMapRebake& other)            = delete;
+  DynamicMapRebake& operator=(const DynamicMapRebake& other) = delete;
+
+private:
+  HeightmapBindings m_heightmapDescriptors;
+  ArenaBuffer       m_compressGeometry;
+  ArenaBuffer       m_micromapScratch;
+  VkDeviceAddress   m_values;
+  VkDeviceAddress   m_triangles;
+  uint32_t          m_level          = 0;
+  uint32_t          m_workgroupCount = 0;
+};
+
+// Transient resources to create a map from hrtxMapSerializedData() output
+// instead of baking it. The device data is copied from the user's buffer, or
+// uploaded through a staging buffer if source is null, and the micromap is
+// built from it directly. Edge decimation flags are copied into the map's
+// primitiveFlags buffer, which is null if the map has none.
+class MapLoad : public Transient
+{
+public:
+  MapLoad(VkCommandBuffer          cmd,
+          HrtxPipeline_T&          hrtxPipeline,
+          const SerializedMapView& data,
+          VkBuffer                 source,
+          VkDeviceSize             sourceOffset,
+          const BuiltMicromap&     builtMicromap,
+          const ArenaBuffer*       primitiveFlags)
+  {
+    const HrtxContext&         ctx    = hrtxPipeline.ctx();
+    const SerializedMapHeader& header = data.header;
+    if(!source)
+    {
+      m_staging = std::make_unique<Buffer>(ctx, header.deviceDataSize(), VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                                           VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+      void* staging = m_staging->map();
+      assert(staging && "HrtxAllocatorCallbacks::mapBuffer is required");
+      memcpy(staging, data.deviceData, static_cast<size_t>(header.deviceDataSize()));
+      source       = *m_staging;
+      sourceOffset = 0;
+    }
+
+    m_data.values    = std::make_unique<ArenaBuffer>(hrtxPipeline.bakeArena(), header.valuesSize);
+    m_data.triangles = std::make_unique<ArenaBuffer>(hrtxPipeline.bakeArena(), header.trianglesSize);
+    if(header.vertexBiasAndScaleSize)
+    {
+      m_vertexBiasAndScale =
+          std::make_unique<ArenaBuffer>(hrtxPipeline.vertexDataArena(), header.vertexBiasAndScaleSize);
+    }
+
+    // Copy each range of the source, in the order they were serialized
+    const std::array<const ArenaBuffer*, 4> buffers{m_data.values.get(), m_data.triangles.get(),
+                                                    m_vertexBiasAndScale.get(), primitiveFlags};
+    for(const ArenaBuffer* buffer : buffers)
+    {
+      if(buffer)
+      {
+        VkBufferCopy region{sourceOffset, buffer->offset(), buffer->size()};
+        ctx.vk.vkCmdCopyBuffer(cmd, source, buffer->buffer(), 1, &region);
+        sourceOffset += buffer->size();
+      }
+    }
+
+    // Barrier between the uploads and vkCmdBuildMicromapsEXT()
+    memoryBarrier2(cmd, ctx, VK_PIPELINE_STAGE_2_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT,
+                   VK_PIPELINE_STAGE_2_MICROMAP_BUILD_BIT_EXT, VK_ACCESS_2_MICROMAP_READ_BIT_EXT);
+    BufferArena& scratchArena = hrtxPipeline.scratchArena();
+    m_micromapScratch =
+        std::make_unique<ArenaBuffer>(scratchArena, align_up(builtMicromap.buildScratchSize(), scratchArena.alignment()));
+    VkMicromapBuildInfoEXT buildInfo =
+        builtMicromap.buildInfo(m_micromapScratch->address(), m_data.values->address(), m_data.triangles->address());
+    ctx.vk.vkCmdBuildMicromapsEXT(cmd, 1, &buildInfo);
+  }
+
+  // Per-vertex bias and scale, or null, and the values and triangles of a map
+  // created with HRTX_MAP_CREATE_ALLOW_UPDATE_BIT. Ownership moves to the map
+  // as for BaryDataVk.
+  std::unique_ptr<ArenaBuffer> takeVertexBiasAndScale() { return std::move(m_vertexBiasAndScale); }
+  UpdatableBaryData            takeUpdatableData() { return std::move(m_data); }
+
+  // Values and triangles, if not taken by the map
+  VkDescriptorBufferInfo valuesDescriptor() const { return m_data.values->descriptor(); }
+  VkDescriptorBufferInfo trianglesDescriptor() const { return m_data.triangles->descriptor(); }
+
+  bool released() const { return !m_micromapScratch; }
+  void release() override
+  {
+    m_staging.reset();
+    m_data = UpdatableBaryData{};
+    m_micromapScratch.reset();
+  }
+
+  void addMemorySize(HrtxMapStatistics* statistics) const
+  {
+    ::addMemorySize(statistics, m_data);
+    statistics->scratchMemorySize += bufferSize(m_micromapScratch);
+    statistics->otherMemorySize += bufferSize(m_staging);
+  }
+
+  MapLoad(const MapLoad& other)            = delete;
+  MapLoad& operator=(const MapLoad& other) = delete;
+
+private:
+  std::unique_ptr<Buffer>      m_staging;
+  UpdatableBaryData            m_data;
+  std::unique_ptr<ArenaBuffer> m_vertexBiasAndScale;
+  std::unique_ptr<ArenaBuffer> m_micromapScratch;
+};
+
+// Host visible copy of a map's device data for hrtxMapSerializedData(),
+// recorded by hrtxCmdSerializeMap(). The header and usages are known when
+// recording and are prepended when the data is read.
+class MapReadback
+{
+public:
+  // Sources are the values, triangles, per-vertex bias and scale and
+  // primitive flags, the last two of which may be empty
+  MapReadback(VkCommandBuffer                              cmd,
+              const HrtxContext&                           ctx,
+              uint64_t                                     createHash,
+              uint32_t                                     triangleCount,
+              const std::vector<VkMicromapUsageEXT>&       usages,
+              const std::array<VkDescriptorBufferInfo, 4>& sources)
+      : m_usages(usages)
+  {
+    m_header = SerializedMapHeader{
+        SerializedMapHeader::currentMagic,
+        SerializedMapHeader::currentVersion,
+        createHash,
+        static_cast<uint32_t>(usages.size()),
+        triangleCount,
+        sources[0].range,
+        sources[1].range,
+        sources[2].range,
+        sources[3].range,
+    };
+    m_readback = std::make_unique<Buffer>(ctx, m_header.deviceDataSize(), VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                                          VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    m_readbackData = static_cast<const char*>(m_readback->map());
+    assert(m_readbackData && "HrtxAllocatorCallbacks::mapBuffer is required");
+
+    // The data may have just been written by a bake, load or update
+    memoryBarrier(cmd, ctx, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+                  VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                  VK_ACCESS_TRANSFER_READ_BIT);
+    VkDeviceSize offset = 0;
+    for(const VkDescriptorBufferInfo& source : sources)
+    {
+      if(source.range)
+      {
+        VkBufferCopy region{source.offset, offset, source.range};
+        ctx.vk.vkCmdCopyBuffer(cmd, source.buffer, *m_readback, 1, &region);
+        offset += source.range;
+      }
+    }
+    memoryBarrier(cmd, ctx, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT, VK_PIPELINE_STAGE_HOST_BIT,
+                  VK_ACCESS_HOST_READ_BIT);
+  }
+
+  size_t       size() const { return m_header.totalSize(); }
+  VkDeviceSize memorySize() const { return m_readback->size(); }
+
+  // Writes the serialized data. The command buffer must have completed
+  // execution.
+  void read(void* data) const
+  {
+    char* dst        = static_cast<char*>(data);
+    char* usages     = dst + sizeof(m_header);
+    char* deviceData = usages + m_header.usagesSize();
+    memcpy(dst, &m_header, sizeof(m_header));
+    memcpy(usages, m_usages.data(), m_header.usagesSize());
+    memcpy(deviceData, m_readbackData, static_cast<size_t>(m_header.deviceDataSize()));
+  }
+
+  MapReadback(const MapReadback& other)            = delete;
+  MapReadback& operator=(const MapReadback& other) = delete;
+
+private:
+  SerializedMapHeader             m_header;
+  std::vector<VkMicromapUsageEXT> m_usages;
+  std::unique_ptr<Buffer>         m_readback;
+  const char*                     m_readbackData = nullptr;
+};
+
+// Transient resources to bake a batch of maps. These are shared by all maps
+// created in one hrtxCmdCreateMaps() call and are only needed until the
+// command buffer completes. They are freed by release() or when the last map
+// in the batch drops its reference.
+class BakeBatch : public Transient
+{
+public:
+  BakeBatch(VkCommandBuffer                                    cmd,
+            HrtxPipeline_T&                                    hrtxPipeline,
+            const std::vector<BakeInput>&                      inputs,
+            std::vector<std::shared_ptr<const AdaptiveLevels>> adaptiveLevels,
+            uint32_t                                           mapCount)
+      : m_queries(hrtxPipeline.instrumentationFlags() ?
+                      std::make_unique<BakeQueries>(cmd, hrtxPipeline.ctx(), hrtxPipeline.instrumentationFlags(),
+                                                    hrtxPipeline.timestampPeriod()) :
+                      nullptr)
+      , m_baryData(std::make_unique<BaryDataVk>(cmd, hrtxPipeline, inputs, m_queries.get()))
+      , m_adaptiveLevels(std::move(adaptiveLevels))
+      , m_mapCount(mapCount)
+      , m_instrumented(m_queries != nullptr)
+  {
+  }
+
+  // Records a single vkCmdBuildMicromapsEXT() for all micromaps in the batch,
+  // indexed in the same order as the inputs
+  void cmdBuildMicromaps(VkCommandBuffer cmd, HrtxPipeline_T& hrtxPipeline, const std::vector<const BuiltMicromap*>& micromaps)
+  {
+    assert(micromaps.size() == m_baryData->geometryCount());
+    const HrtxContext& ctx              = hrtxPipeline.ctx();
+    BufferArena&       scratchArena     = hrtxPipeline.scratchArena();
+    VkDeviceSize       scratchAlignment = scratchArena.alignment();
+    VkDeviceSize       scratchSize      = 0;
+    for(const BuiltMicromap* micromap : micromaps)
+    {
+      scratchSize += align_up(micromap->buildScratchSize(), scratchAlignment);
+    }
+
+    // Scratch memory is freed back to the arena and reused by later bakes
+    // after the batch is released
+    m_micromapScratch = std::make_unique<ArenaBuffer>(scratchArena, scratchSize);
+
+    std::vector<VkMicromapBuildInfoEXT> buildInfos;
+    VkDeviceAddress                     scratchAddress = m_micromapScratch->address();
+    for(uint32_t i = 0; i < micromaps.size(); ++i)
+    {
+      const BaryGeometry& geometry = m_baryData->geometry(i);
+      buildInfos.push_back(micromaps[i]->buildInfo(scratchAddress, geometry.valuesAddress, geometry.trianglesAddress));
+      scratchAddress += align_up(micromaps[i]->buildScratchSize(), scratchAlignment);
+    }
+    ctx.vk.vkCmdBuildMicromapsEXT(cmd, static_cast<uint32_t>(buildInfos.size()), buildInfos.data());
+
+    // Query compacted sizes for hrtxCmdCompactMap()
+    std::vector<VkMicromapEXT> compactable;
+    for(const BuiltMicromap* micromap : micromaps)
+    {
+      m_compactedSizeQueries.push_back(micromap->allowCompaction() ? static_cast<uint32_t>(compactable.size()) : ~0U);
+      if(micromap->allowCompaction())
+      {
+        compactable.push_back(micromap->micromap());
+      }
+    }
+    if(!compactable.empty())
+    {
+      m_compactedSizes = std::make_unique<QueryPool>(ctx, VK_QUERY_TYPE_MICROMAP_COMPACTED_SIZE_EXT,
+                                                     static_cast<uint32_t>(compactable.size()));
+      m_compactedSizes->cmdReset(cmd);
+      memoryBarrier2(cmd, ctx, VK_PIPELINE_STAGE_2_MICROMAP_BUILD_BIT_EXT, VK_ACCESS_2_MICROMAP_WRITE_BIT_EXT,
+                     VK_PIPELINE_STAGE_2_MICROMAP_BUILD_BIT_EXT, VK_ACCESS_2_MICROMAP_READ_BIT_EXT);
+      ctx.vk.vkCmdWriteMicromapsPropertiesEXT(cmd, static_cast<uint32_t>(compactable.size()), compactable.data(),
+                                              VK_QUERY_TYPE_MICROMAP_COMPACTED_SIZE_EXT, *m_compactedSizes, 0);
+    }
+    if(m_queries)
+    {
+      m_queries->cmdWriteTimestamp(cmd, BakeQueries::TimestampMicromapBuild,
+                                   VK_PIPELINE_STAGE_2_MICROMAP_BUILD_BIT_EXT);
+    }
+  }
+
+  // Writes the batch's instrumentation results. Returns VK_NOT_READY if the
+  // commands have not yet completed or the resources were released.
+  VkResult queryResults(HrtxMapStatistics* statistics) const
+  {
+    return m_queries ? m_queries->results(statistics) : VK_NOT_READY;
+  }
+  uint32_t mapCount() const { return m_mapCount; }
+  bool     instrumented() const { return m_instrumented; }
+
+  // Reads the compacted micromap size of a map in the batch. Returns
+  // VK_NOT_READY if the micromap build has not yet completed.
+  VkResult compactedSize(const HrtxContext& ctx, uint32_t index, VkDeviceSize* size) const
+  {
+    assert(m_compactedSizes && m_compactedSizeQueries[index] != ~0U);
+    uint64_t result      = 0;
+    VkResult queryResult = ctx.vk.vkGetQueryPoolResults(ctx.device, *m_compactedSizes, m_compactedSizeQueries[index], 1,
+                                                        sizeof(result), &result, sizeof(result), VK_QUERY_RESULT_64_BIT);
+    *size = result;
+    return queryResult;
+  }
+  bool released() const { return !m_baryData; }
+  const BaryDataVk& baryData() const
+  {
+    assert(m_baryData && "bake resources were already released");
+    return *m_baryData;
+  }
+  BaryDataVk& baryData()
+  {
+    assert(m_baryData && "bake resources were already released");
+    return *m_baryData;
+  }
+
+  // Frees all transient resources. The command buffer the batch was recorded
+  // into must have completed execution.
+  void release() override
+  {
+    m_queries.reset();
+    m_baryData.reset();
+    m_micromapScratch.reset();
+    m_compactedSizes.reset();
+    m_adaptiveLevels.clear();
+  }
+
+  void addMemorySize(HrtxMapStatistics* statistics) const
+  {
+    if(m_baryData)
+    {
+      m_baryData->addMemorySize(statistics);
+    }
+    statistics->scratchMemorySize += bufferSize(m_micromapScratch);
+    for(const std::shared_ptr<const AdaptiveLevels>& levels : m_adaptiveLevels)
+    {
+      levels->addMemorySize(statistics);
+    }
+  }
+
+  BakeBatch(const BakeBatch& other)            = delete;
+  BakeBatch& operator=(const BakeBatch& other) = delete;
+
+private:
+  std::unique_ptr<BakeQueries> m_queries;
+  std::unique_ptr<BaryDataVk>  m_baryData;
+  std::unique_ptr<ArenaBuffer> m_micromapScratch;
+  std::unique_ptr<QueryPool>   m_compactedSizes;
+  std::vector<uint32_t>        m_compactedSizeQueries;  // per map, ~0U if not compactable
+
+  // Level lists read by the bake of adaptive maps
+  std::vector<std::shared_ptr<const AdaptiveLevels>> m_adaptiveLevels;
+
+  uint32_t m_mapCount;
+  bool     m_instrumented;
 };
 
 struct HrtxMap_T
 {
-  HrtxMap_T(VkCommandBuffer cmd, const HrtxPipeline_T& hrtxPipeline, const HrtxMapCreate& create)
-      : m_biasAndScale(hrtxPipeline.ctx(), sizeof(float) * 2, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT)
+  HrtxMap_T(HrtxPipeline_T& hrtxPipeline, const HrtxMapCreate& create)
+      : m_biasScaleTable(hrtxPipeline.biasScaleTable())
+      , m_biasScaleSlot(m_biasScaleTable.allocate())
       , m_directionsBuffer(create.directionsBuffer)
       , m_directionsFormat(create.directionsFormat)
       , m_directionsStride(create.directionsStride)
-      , m_baryData(cmd, hrtxPipeline, create)
-      , m_builtMicromap(cmd, hrtxPipeline.ctx(), m_baryData)
+      , m_serializedHash(serializedCreateHash(create))
+      , m_primitiveCount(create.primitiveCount)
+      , m_pendingBake(std::make_unique<PendingBake>(create))
   {
-    float biasScale[2]{create.heightmapBias, create.heightmapScale};
-    m_biasAndScale.update(cmd, &biasScale);
+    // Uploaded by the map's bake, followed by the barrier to the user's BVH build
+    m_biasScaleTable.set(m_biasScaleSlot, create.heightmapBias, create.heightmapScale);
 
-    // Barrier between writing m_biasAndScale and reading in the user's BVH
-    // build. vkCmdCopyBuffer() is treated as a "transfer" operation.
-    memoryBarrier2(cmd, hrtxPipeline.ctx(), VK_PIPELINE_STAGE_2_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT,
-                   VK_PIPELINE_STAGE_2_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, VK_ACCESS_2_ACCELERATION_STRUCTURE_READ_BIT_KHR);
+    // Written by the levels passes or copied by a load
+    if(create.flags & HRTX_MAP_CREATE_ADAPTIVE_SUBDIVISION_BIT)
+    {
+      m_primitiveFlags =
+          std::make_unique<ArenaBuffer>(hrtxPipeline.vertexDataArena(), primitiveFlagsSize(create.primitiveCount));
+    }
   }
-
+  ~HrtxMap_T() { m_biasScaleTable.free(m_biasScaleSlot); }
   HrtxMap_T(const HrtxMap_T& other)            = delete;
   HrtxMap_T& operator=(const HrtxMap_T& other) = delete;
 
-  VkAccelerationStructureTrianglesDisplacementMicromapNV descriptor()
+  // Writes new values to the pipeline's table, to be uploaded with
+  // BiasScaleTable::cmdUpload() of biasScaleSlot(). Maps with displacement
+  // bounds have per-vertex values and are not affected, returning false.
+  bool setBiasScale(float bias, float scale)
+  {
+    if(m_vertexBiasAndScale)
+    {
+      return false;
+    }
+    m_biasScaleTable.set(m_biasScaleSlot, bias, scale);
+    return true;
+  }
+  uint32_t biasScaleSlot() const { return m_biasScaleSlot; }
+
+  // Levels of detail, including LOD 0
+  uint32_t lodCount() const
+  {
+    return 1U + static_cast<uint32_t>(m_pendingBake ? m_pendingBake->lodCreates.size() : m_lods.size());
+  }
+
+  // Descriptor of level of detail lod, clamped to the coarsest
+  VkAccelerationStructureTrianglesDisplacementMicromapNV descriptor(uint32_t lod)
   {
+    assert(m_builtMicromap && "adaptive maps must be built with hrtxCmdBuildMaps() first");
+    lod                                     = std::min(lod, lodCount() - 1U);
+    const BuiltMicromap& builtMicromap      = lodMicromap(lod);
+    const ArenaBuffer*   vertexBiasAndScale = lodVertexBiasAndScale(lod);
     return VkAccelerationStructureTrianglesDisplacementMicromapNV{
         VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_TRIANGLES_DISPLACEMENT_MICROMAP_NV,
         nullptr,
         VK_FORMAT_R32G32_SFLOAT,
         m_directionsFormat,
-        {m_biasAndScale.address()},
-        0,  // same bias and scale for all directions
+        {vertexBiasAndScale ? vertexBiasAndScale->address() : m_biasScaleTable.address(m_biasScaleSlot)},
+        vertexBiasAndScale ? sizeof(float) * 2 : 0,  // per-vertex, or same bias and scale for all
         m_directionsBuffer,
         m_directionsStride,
-        {},
-        0,
+        {m_primitiveFlags ? m_primitiveFlags->address() : 0},
+        m_primitiveFlags ? sizeof(uint8_t) : 0,  // edge decimation flags of adaptive levels
         VK_INDEX_TYPE_NONE_KHR,
         {},
         0,
         0,
-        static_cast<uint32_t>(m_builtMicromap.usages().size()),
-        m_builtMicromap.usages().data(),
+        static_cast<uint32_t>(builtMicromap.usages().size()),
+        builtMicromap.usages().data(),
         nullptr,
-        m_builtMicromap.micromap(),
+        builtMicromap.micromap(),
     };
   }
+  const BuiltMicromap& builtMicromap() const { return *m_builtMicromap; }
+  const BuiltMicromap& lodMicromap(uint32_t lod) const
+  {
+    return lod == 0 ? *m_builtMicromap : *m_lods[lod - 1].builtMicromap;
+  }
+  const ArenaBuffer* lodVertexBiasAndScale(uint32_t lod) const
+  {
+    return lod == 0 ? m_vertexBiasAndScale.get() : m_lods[lod - 1].vertexBiasAndScale.get();
+  }
+
+  // Buffers written by the bake and read by the user's BVH build, i.e. those
+  // passed between queue families when baking on a different queue
+  void appendBvhInputs(std::vector<VkDescriptorBufferInfo>& buffers) const
+  {
+    buffers.push_back(m_builtMicromap->micromap().descriptor());
+    buffers.push_back(m_vertexBiasAndScale ? m_vertexBiasAndScale->descriptor() : m_biasScaleTable.descriptor(m_biasScaleSlot));
+    for(const Lod& lod : m_lods)
+    {
+      buffers.push_back(lod.builtMicromap->micromap().descriptor());
+      if(lod.vertexBiasAndScale)
+      {
+        buffers.push_back(lod.vertexBiasAndScale->descriptor());
+      }
+    }
+    if(m_primitiveFlags)
+    {
+      buffers.push_back(m_primitiveFlags->descriptor());
+    }
+    if(m_pretessellated)
+    {
+      m_pretessellated->appendBvhInputs(buffers);
+    }
+  }
+
+  // Maps created with HRTX_MAP_CREATE_ADAPTIVE_SUBDIVISION_BIT are baked with
+  // per-triangle levels from entry index of adaptiveLevels
+  void setAdaptiveLevels(std::shared_ptr<const AdaptiveLevels> adaptiveLevels, uint32_t index)
+  {
+    m_pendingBake->adaptiveLevels = std::move(adaptiveLevels);
+    m_pendingBake->adaptiveIndex  = index;
+  }
+
+  // For subdivision levels above maxSubdivisionLevel, records the
+  // tessellation of the map's triangles and bakes the result instead. A
+  // compute barrier is needed before the map's levels pass or bake.
+  bool cmdPretessellate(VkCommandBuffer cmd, HrtxPipeline_T& hrtxPipeline)
+  {
+    HrtxMapCreate& create = m_pendingBake->create;
+    if(PretessellatedGeometry::pretessellationLevel(create.subdivisionLevel) == 0)
+    {
+      return false;
+    }
+    m_pretessellated = std::make_unique<PretessellatedGeometry>(hrtxPipeline, create);
+    m_pretessellated->cmdTessellate(cmd, hrtxPipeline, create);
+    m_pretessellated->replaceInputs(create, m_pendingBake->triangles);
+    m_directionsBuffer = create.directionsBuffer;
+    m_directionsFormat = create.directionsFormat;
+    m_directionsStride = create.directionsStride;
+    return true;
+  }
+  const PretessellatedGeometry* pretessellated() const { return m_pretessellated.get(); }
+
+  // True until the map has been passed to cmdBakeMaps()
+  bool pendingBake() const { return m_pendingBake != nullptr; }
+  const HrtxMapCreate& pendingCreate() const { return m_pendingBake->create; }
+  bool pendingAdaptiveLevels() const { return m_pendingBake && m_pendingBake->adaptiveLevels; }
+  bool adaptiveLevelsComplete() const
+  {
+    return m_pendingBake->adaptiveLevels->complete(m_pendingBake->create, m_pendingBake->adaptiveIndex);
+  }
+  const ArenaBuffer* primitiveFlags() const { return m_primitiveFlags.get(); }
+  BakeInput bakeInput() const
+  {
+    const PendingBake& pending = *m_pendingBake;
+    return pending.adaptiveLevels ? pending.adaptiveLevels->bakeInput(pending.create, pending.adaptiveIndex) :
+                                    uniformBakeInput(pending.create);
+  }
+  const std::shared_ptr<const AdaptiveLevels>& adaptiveLevels() const { return m_pendingBake->adaptiveLevels; }
+  BakeInput lodBakeInput(uint32_t lod) const { return uniformBakeInput(m_pendingBake->lodCreates[lod - 1]); }
+
+  // Takes this map's results from entry batchIndex of a bake, and those of
+  // its coarser levels of detail from consecutive entries starting at
+  // firstLodIndex. The micromap builds are recorded later by
+  // BakeBatch::cmdBuildMicromaps().
+  void setBake(HrtxPipeline_T&            hrtxPipeline,
+               std::shared_ptr<BakeBatch> bakeBatch,
+               uint32_t                   batchIndex,
+               uint32_t                   firstLodIndex)
+  {
+    bool allowCompaction = (m_pendingBake->create.flags & HRTX_MAP_CREATE_ALLOW_COMPACTION_BIT) != 0;
+    m_bakeBatch          = std::move(bakeBatch);
+    m_batchIndex         = batchIndex;
+    m_batchMapCount      = m_bakeBatch->mapCount();
+    m_batchInstrumented  = m_bakeBatch->instrumented();
+    m_vertexBiasAndScale = m_bakeBatch->baryData().takeVertexBiasAndScale(batchIndex);
+    m_updatableData      = m_bakeBatch->baryData().takeUpdatableData(batchIndex);
+    m_builtMicromap      = std::make_unique<BuiltMicromap>(hrtxPipeline.micromapArena(),
+                                                      m_bakeBatch->baryData().geometry(batchIndex).usages,
+                                                      allowCompaction);
+    for(uint32_t lod = 1; lod <= m_pendingBake->lodCreates.size(); ++lod)
+    {
+      uint32_t index = firstLodIndex + lod - 1;
+      m_lods.push_back(Lod{
+          m_bakeBatch->baryData().takeVertexBiasAndScale(index),
+          std::make_unique<BuiltMicromap>(hrtxPipeline.micromapArena(), m_bakeBatch->baryData().geometry(index).usages,
+                                          allowCompaction),
+          index,
+      });
+    }
+
+    // Updatable maps keep their inputs to re-bake from
+    if(m_updatableData.values)
+    {
+      m_updateSource = std::move(m_pendingBake);
+      m_updateSource->adaptiveLevels.reset();
+    }
+    m_pendingBake.reset();
+  }
+
+  // Takes this map's data from serialized data instead of baking it, with the
+  // device data in source if it is not null. The micromap build is recorded
+  // immediately.
+  void cmdLoad(VkCommandBuffer          cmd,
+               HrtxPipeline_T&          hrtxPipeline,
+               const SerializedMapView& data,
+               VkBuffer                 source,
+               VkDeviceSize             sourceOffset)
+  {
+    // The compacted size query is only made by bakes
+    m_builtMicromap      = std::make_unique<BuiltMicromap>(hrtxPipeline.micromapArena(), data.usages, false);
+    m_load = std::make_shared<MapLoad>(cmd, hrtxPipeline, data, source, sourceOffset, *m_builtMicromap,
+                                       m_primitiveFlags.get());
+    m_vertexBiasAndScale = m_load->takeVertexBiasAndScale();
+    m_loaded             = true;
+    hrtxPipeline.trackTransient(cmd, m_load);
+    if(m_pendingBake->create.flags & HRTX_MAP_CREATE_ALLOW_UPDATE_BIT)
+    {
+      m_updatableData = m_load->takeUpdatableData();
+      m_updateSource  = std::move(m_pendingBake);
+    }
+    m_pendingBake.reset();
+  }
+
+  // Records a copy of the map's device data to host visible memory for
+  // serializedData(). The data is kept with the bake resources unless the map
+  // was created with HRTX_MAP_CREATE_ALLOW_UPDATE_BIT.
+  VkResult cmdSerialize(VkCommandBuffer cmd, HrtxPipeline_T& hrtxPipeline)
+  {
+    if(m_pendingBake)
+    {
+      return VK_ERROR_INITIALIZATION_FAILED;
+    }
+    // Loading would need to repeat the pre-tessellation
+    if(m_pretessellated || !hrtxPipeline.ctx().allocator.mapBuffer)
+    {
+      return VK_ERROR_FEATURE_NOT_PRESENT;
+    }
+
+    std::array<VkDescriptorBufferInfo, 4> sources{};
+    if(m_updatableData.values)
+    {
+      sources[0] = m_updatableData.values->descriptor();
+      sources[1] = m_updatableData.triangles->descriptor();
+    }
+    else if(m_bakeBatch && !m_bakeBatch->released())
+    {
+      sources[0] = m_bakeBatch->baryData().valuesDescriptor(m_batchIndex);
+      sources[1] = m_bakeBatch->baryData().trianglesDescriptor(m_batchIndex);
+    }
+    else if(m_load && !m_load->released())
+    {
+      sources[0] = m_load->valuesDescriptor();
+      sources[1] = m_load->trianglesDescriptor();
+    }
+    else
+    {
+      return VK_ERROR_INITIALIZATION_FAILED;
+    }
+    if(m_vertexBiasAndScale)
+    {
+      sources[2] = m_vertexBiasAndScale->descriptor();
+    }
+    if(m_primitiveFlags)
+    {
+      sources[3] = m_primitiveFlags->descriptor();
+    }
+    m_readback = std::make_unique<MapReadback>(cmd, hrtxPipeline.ctx(), m_serializedHash, m_primitiveCount,
+                                               m_builtMicromap->usages(), sources);
+    return VK_SUCCESS;
+  }
+
+  // Copies out the data recorded by cmdSerialize(), which is freed once it
+  // has been written in full
+  VkResult serializedData(size_t* dataSize, void* data)
+  {
+    if(!m_readback)
+    {
+      return VK_ERROR_INITIALIZATION_FAILED;
+    }
+    if(!data)
+    {
+      *dataSize = m_readback->size();
+      return VK_SUCCESS;
+    }
+    if(*dataSize < m_readback->size())
+    {
+      *dataSize = 0;
+      return VK_INCOMPLETE;
+    }
+    *dataSize = m_readback->size();
+    m_readback->read(data);
+    m_readback.reset();
+    return VK_SUCCESS;
+  }
+
+  // Re-bakes the triangles overlapping region and rebuilds the micromap
+  VkResult cmdUpdate(VkCommandBuffer cmd, HrtxPipeline_T& hrtxPipeline, const HrtxMapRegion& region)
+  {
+    if(m_pendingBake)
+    {
+      return VK_ERROR_INITIALIZATION_FAILED;
+    }
+    if(!m_updateSource)
+    {
+      return VK_ERROR_FEATURE_NOT_PRESENT;
+    }
+    HeightmapTablePin heightmapPin;
+    if(!hrtxPipeline.pinHeightmaps({m_updateSource->create.heightmapImage}, heightmapPin))
+    {
+      return VK_ERROR_TOO_MANY_OBJECTS;
+    }
+
+    // Forget updates whose resources were released in bulk by the pipeline
+    m_updates.erase(std::remove_if(m_updates.begin(), m_updates.end(),
+                                   [](const std::shared_ptr<MapUpdate>& update) { return update->released(); }),
+                    m_updates.end());
+    m_updates.push_back(std::make_shared<MapUpdate>(cmd, hrtxPipeline, m_updateSource->create,
+                                                    targetMicromap(hrtxPipeline), m_updatableData.values->address(),
+                                                    m_updatableData.triangles->address(), region));
+    hrtxPipeline.trackTransient(cmd, m_updates.back());
+    swapDynamicMicromaps();
+    return VK_SUCCESS;
+  }
+
+  // Re-bakes every triangle of a dynamic map into its other micromap, which
+  // becomes current
+  VkResult cmdRebake(VkCommandBuffer cmd, HrtxPipeline_T& hrtxPipeline)
+  {
+    if(m_pendingBake)
+    {
+      return VK_ERROR_INITIALIZATION_FAILED;
+    }
+    if(!m_updateSource || !(m_updateSource->create.flags & HRTX_MAP_CREATE_DYNAMIC_BIT))
+    {
+      return VK_ERROR_FEATURE_NOT_PRESENT;
+    }
+    if(!m_dynamicRebake)
+    {
+      // The rebake then holds the heightmap's slot until the map is destroyed
+      HeightmapTablePin heightmapPin;
+      if(!hrtxPipeline.pinHeightmaps({m_updateSource->create.heightmapImage}, heightmapPin))
+      {
+        return VK_ERROR_TOO_MANY_OBJECTS;
+      }
+      m_dynamicRebake = std::make_unique<DynamicMapRebake>(cmd, hrtxPipeline, m_updateSource->create, *m_builtMicromap,
+                                                           m_updatableData.values->address(),
+                                                           m_updatableData.triangles->address());
+    }
+    m_dynamicRebake->cmdRebake(cmd, hrtxPipeline, targetMicromap(hrtxPipeline));
+    swapDynamicMicromaps();
+    return VK_SUCCESS;
+  }
+
+  // Sizes from the map's usages and its batch's instrumentation results,
+  // which are only missing if the batch was instrumented
+  VkResult statistics(HrtxMapStatistics* statistics) const
+  {
+    *statistics = HrtxMapStatistics{};
+    for(const VkMicromapUsageEXT& usage : m_builtMicromap->usages())
+    {
+      uint64_t edgeSegments = 1ULL << usage.subdivisionLevel;
+      statistics->microTriangleCount += uint64_t(usage.count) * edgeSegments * edgeSegments;
+      statistics->microVertexCount += uint64_t(usage.count) * (((edgeSegments + 1) * (edgeSegments + 2)) / 2);
+      statistics->valuesSize += usageValuesBytes(usage);
+      statistics->trianglesSize += VkDeviceSize(usage.count) * sizeof(VkMicromapTriangleEXT);
+    }
+    statistics->micromapSize = m_builtMicromap->memorySize();
+    statistics->usageCount   = static_cast<uint32_t>(m_builtMicromap->usages().size());
+    statistics->usages       = m_builtMicromap->usages().data();
+    addMemorySize(statistics);
+
+    // Loaded maps were not baked, and have no batch
+    statistics->batchMapCount = m_batchMapCount;
+    if(m_loaded || !m_batchInstrumented)
+    {
+      return VK_SUCCESS;
+    }
+    return m_bakeBatch ? m_bakeBatch->queryResults(statistics) : VK_NOT_READY;
+  }
+
+  // Drops this map's reference to the batch's transient bake resources,
+  // leaving only the micromap and bias/scale buffers.
+  void releaseBakeResources()
+  {
+    m_bakeBatch.reset();
+    m_load.reset();
+    m_uncompactedMicromap.reset();
+    m_updates.clear();
+  }
+
+  VkResult cmdCompact(VkCommandBuffer cmd, HrtxPipeline_T& hrtxPipeline)
+  {
+    if(!m_builtMicromap)
+    {
+      return VK_ERROR_INITIALIZATION_FAILED;
+    }
+    // Updates rebuild into the original micromap
+    if(!m_builtMicromap->allowCompaction() || m_updateSource)
+    {
+      return VK_ERROR_FEATURE_NOT_PRESENT;
+    }
+
+    // The query lives with the bake resources and a map can only be compacted once
+    if(!m_bakeBatch || m_bakeBatch->released() || m_uncompactedMicromap)
+    {
+      return VK_ERROR_INITIALIZATION_FAILED;
+    }
+
+    // All levels of detail are compacted together once all their sizes are known
+    const HrtxContext&        ctx = hrtxPipeline.ctx();
+    std::vector<VkDeviceSize> compactedSizes(lodCount());
+    for(uint32_t lod = 0; lod < lodCount(); ++lod)
+    {
+      uint32_t batchIndex = lod == 0 ? m_batchIndex : m_lods[lod - 1].batchIndex;
+      VkResult result     = m_bakeBatch->compactedSize(ctx, batchIndex, &compactedSizes[lod]);
+      if(result != VK_SUCCESS)
+      {
+        return result;
+      }
+    }
+
+    BufferArena&                           micromapArena = hrtxPipeline.micromapArena();
+    std::vector<std::unique_ptr<Micromap>> uncompacted;
+    uncompacted.push_back(m_builtMicromap->cmdCompact(cmd, micromapArena, compactedSizes[0]));
+    for(Lod& lod : m_lods)
+    {
+      uncompacted.push_back(lod.builtMicromap->cmdCompact(cmd, micromapArena, compactedSizes[uncompacted.size()]));
+    }
+    m_uncompactedMicromap = std::make_shared<UncompactedMicromap>(std::move(uncompacted));
+    hrtxPipeline.trackTransient(cmd, m_uncompactedMicromap);
+
+    // Barrier between the copy and reading the micromap in the user's BVH build
+    memoryBarrier2(cmd, ctx, VK_PIPELINE_STAGE_2_MICROMAP_BUILD_BIT_EXT, VK_ACCESS_2_MICROMAP_WRITE_BIT_EXT,
+                   VK_PIPELINE_STAGE_2_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, VK_ACCESS_2_ACCELERATION_STRUCTURE_READ_BIT_KHR);
+    return VK_SUCCESS;
+  }
 
 private:
-  Buffer                        m_biasAndScale;
-  VkDeviceOrHostAddressConstKHR m_directionsBuffer;
-  VkFormat                      m_directionsFormat;
-  VkDeviceSize                  m_directionsStride;
-  BaryDataVk                    m_baryData;
-  BuiltMicromap                 m_builtMicromap;
+  bool dynamic() const { return m_updateSource && (m_updateSource->create.flags & HRTX_MAP_CREATE_DYNAMIC_BIT); }
+
+  // The micromap an update or re-bake builds into. Dynamic maps build into
+  // their spare micromap, created with the same usages on first use, rather
+  // than the current one that may still be traced.
+  const BuiltMicromap& targetMicromap(HrtxPipeline_T& hrtxPipeline)
+  {
+    if(!dynamic())
+    {
+      return *m_builtMicromap;
+    }
+    if(!m_spareMicromap)
+    {
+      m_spareMicromap = std::make_unique<BuiltMicromap>(hrtxPipeline.micromapArena(), m_builtMicromap->usages(),
+                                                        m_builtMicromap->allowCompaction());
+    }
+    return *m_spareMicromap;
+  }
+  void swapDynamicMicromaps()
+  {
+    if(dynamic())
+    {
+      std::swap(m_builtMicromap, m_spareMicromap);
+    }
+  }
+
+  // Copy of the create info, as adaptive maps are baked after
+  // hrtxCmdCreateMaps() returns. The build range is folded into the input
+  // addresses so that the bake always reads from index 0.
+  struct PendingBake
+  {
+    PendingBake(const HrtxMapCreate& create_)
+        : create(create_)
+        , triangles(*create_.triangles)
+    {
+      create.triangles = &triangles;
+      if(create.buildRange)
+      {
+        VkDeviceSize firstVertex = create.buildRange->firstVertex;
+        triangles.indexData.deviceAddress += create.buildRange->primitiveOffset;
+        triangles.vertexData.deviceAddress += firstVertex * triangles.vertexStride;
+        create.textureCoordsBuffer.deviceAddress += firstVertex * create.textureCoordsStride;
+        create.directionsBuffer.deviceAddress += firstVertex * create.directionsStride;
+        create.buildRange = nullptr;
+      }
+
+      // Coarser levels of detail bake the same inputs at lower levels. Those
+      // that would be below level 0 are dropped rather than repeating it.
+      uint32_t levelStep = std::max(create.lodLevelStep, 1U);
+      for(uint32_t lod = 1; lod < create.lodCount && lod * levelStep <= create.subdivisionLevel; ++lod)
+      {
+        lodCreates.push_back(create);
+        lodCreates.back().subdivisionLevel = create.subdivisionLevel - lod * levelStep;
+      }
+    }
+    HrtxMapCreate                                   create;
+    VkAccelerationStructureGeometryTrianglesDataKHR triangles;
+    std::vector<HrtxMapCreate>                      lodCreates;
+    std::shared_ptr<const AdaptiveLevels>           adaptiveLevels;
+    uint32_t                                        adaptiveIndex = 0;
+  };
+
+  // Device memory of the map and any transient resources it still holds
+  void addMemorySize(HrtxMapStatistics* statistics) const
+  {
+    statistics->micromapMemorySize += m_builtMicromap->memorySize();
+    statistics->otherMemorySize += bufferSize(m_vertexBiasAndScale) + bufferSize(m_primitiveFlags);
+    for(const Lod& lod : m_lods)
+    {
+      statistics->micromapMemorySize += lod.builtMicromap->memorySize();
+      statistics->otherMemorySize += bufferSize(lod.vertexBiasAndScale);
+    }
+    if(m_spareMicromap)
+    {
+      statistics->micromapMemorySize += m_spareMicromap->memorySize();
+    }
+    if(m_uncompactedMicromap)
+    {
+      m_uncompactedMicromap->addMemorySize(statistics);
+    }
+    ::addMemorySize(statistics, m_updatableData);
+    for(const std::shared_ptr<MapUpdate>& update : m_updates)
+    {
+      update->addMemorySize(statistics);
+    }
+    if(m_dynamicRebake)
+    {
+      m_dynamicRebake->addMemorySize(statistics);
+    }
+    if(m_pretessellated)
+    {
+      m_pretessellated->addMemorySize(statistics);
+    }
+    if(m_bakeBatch)
+    {
+      m_bakeBatch->addMemorySize(statistics);
+    }
+    if(m_load)
+    {
+      m_load->addMemorySize(statistics);
+    }
+    if(m_readback)
+    {
+      statistics->otherMemorySize += m_readback->memorySize();
+    }
+  }
+
+  // A coarser level of detail, baked in the same batch as LOD 0
+  struct Lod
+  {
+    std::unique_ptr<ArenaBuffer>   vertexBiasAndScale;
+    std::unique_ptr<BuiltMicromap> builtMicromap;
+    uint32_t                       batchIndex;
+  };
+
+  BiasScaleTable&                         m_biasScaleTable;
+  uint32_t                                m_biasScaleSlot;
+  VkDeviceOrHostAddressConstKHR           m_directionsBuffer;
+  VkFormat                                m_directionsFormat;
+  VkDeviceSize                            m_directionsStride;
+  uint64_t                                m_serializedHash;
+  uint32_t                                m_primitiveCount;
+  std::unique_ptr<PendingBake>            m_pendingBake;
+  std::unique_ptr<PretessellatedGeometry> m_pretessellated;
+  std::shared_ptr<BakeBatch>              m_bakeBatch;
+  uint32_t                                m_batchIndex        = 0;
+  uint32_t                                m_batchMapCount     = 0;  // kept after the batch is released
+  bool                                    m_batchInstrumented = false;
+  std::shared_ptr<MapLoad>                m_load;
+  bool                                    m_loaded = false;
+  std::unique_ptr<MapReadback>            m_readback;
+  std::unique_ptr<ArenaBuffer>            m_vertexBiasAndScale;
+  std::unique_ptr<ArenaBuffer>            m_primitiveFlags;
+  std::unique_ptr<BuiltMicromap>          m_builtMicromap;
+  std::vector<Lod>                        m_lods;
+  std::shared_ptr<UncompactedMicromap>    m_uncompactedMicromap;
+  UpdatableBaryData                       m_updatableData;
+  std::unique_ptr<PendingBake>            m_updateSource;
+  std::vector<std::shared_ptr<MapUpdate>> m_updates;
+  std::unique_ptr<BuiltMicromap>          m_spareMicromap;
+  std::unique_ptr<DynamicMapRebake>       m_dynamicRebake;
 };
+
+// Uploads the maps' bias/scale table slots and records the barrier between
+// building micromaps, writing the bias/scale table and per-vertex bias/scale,
+// and reading them in the user's BVH build. vkCmdUpdateBuffer() and
+// vkCmdCopyBuffer() are treated as "transfer" operations.
+inline void cmdFinishMaps(VkCommandBuffer cmd, HrtxPipeline_T& hrtxPipeline, const std::vector<HrtxMap_T*>& maps)
+{
+  std::vector<uint32_t> slots;
+  for(const HrtxMap_T* map : maps)
+  {
+    slots.push_back(map->biasScaleSlot());
+  }
+  hrtxPipeline.biasScaleTable().cmdUpload(cmd, std::move(slots));
+  memoryBarrier2(cmd, hrtxPipeline.ctx(),
+                 VK_PIPELINE_STAGE_2_MICROMAP_BUILD_BIT_EXT | VK_PIPELINE_STAGE_2_TRANSFER_BIT | VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+                 VK_ACCESS_2_MICROMAP_WRITE_BIT_EXT | VK_ACCESS_2_TRANSFER_WRITE_BIT | VK_ACCESS_2_SHADER_WRITE_BIT,
+                 VK_PIPELINE_STAGE_2_ACCELERATION_STRUCTURE_BUILD_BIT_KHR, VK_ACCESS_2_ACCELERATION_STRUCTURE_READ_BIT_KHR);
+}
+
+// Bakes maps and records their micromap builds as one batch, followed by the
+// barrier to the user's BVH build
+inline void cmdBakeMaps(VkCommandBuffer cmd, HrtxPipeline_T& hrtxPipeline, const std::vector<HrtxMap_T*>& maps)
+{
+  std::vector<BakeInput>                             inputs;
+  std::vector<std::shared_ptr<const AdaptiveLevels>> adaptiveLevels;
+  for(HrtxMap_T* map : maps)
+  {
+    inputs.push_back(map->bakeInput());
+    if(map->pendingAdaptiveLevels()
+       && std::find(adaptiveLevels.begin(), adaptiveLevels.end(), map->adaptiveLevels()) == adaptiveLevels.end())
+    {
+      adaptiveLevels.push_back(map->adaptiveLevels());
+    }
+  }
+
+  // Coarser levels of detail follow the finest levels of all maps
+  std::vector<uint32_t> firstLodInputs;
+  for(HrtxMap_T* map : maps)
+  {
+    firstLodInputs.push_back(static_cast<uint32_t>(inputs.size()));
+    for(uint32_t lod = 1; lod < map->lodCount(); ++lod)
+    {
+      inputs.push_back(map->lodBakeInput(lod));
+    }
+  }
+
+  // TODO: passing 'cmd' to the constructor to fill it as a side-effect is a bit of a smell
+  auto bakeBatch = std::make_shared<BakeBatch>(cmd, hrtxPipeline, inputs, std::move(adaptiveLevels),
+                                               static_cast<uint32_t>(maps.size()));
+  std::vector<const BuiltMicromap*> micromaps(inputs.size());
+  for(uint32_t i = 0; i < maps.size(); ++i)
+  {
+    maps[i]->setBake(hrtxPipeline, bakeBatch, i, firstLodInputs[i]);
+    micromaps[i] = &maps[i]->builtMicromap();
+    for(uint32_t lod = 1; lod < maps[i]->lodCount(); ++lod)
+    {
+      micromaps[firstLodInputs[i] + lod - 1] = &maps[i]->lodMicromap(lod);
+    }
+  }
+  bakeBatch->cmdBuildMicromaps(cmd, hrtxPipeline, micromaps);
+  hrtxPipeline.trackTransient(cmd, bakeBatch);
+  cmdFinishMaps(cmd, hrtxPipeline, maps);
+}
+
+// Records a queue family ownership transfer of the maps' outputs read by the
+// user's BVH build. Releases make the bake's writes available and acquires
+// make them visible to the BVH build, matching the barrier at the end of
+// cmdBakeMaps().
+inline void cmdMapsQueueFamilyTransfer(VkCommandBuffer                cmd,
+                                       const HrtxPipeline_T&          hrtxPipeline,
+                                       HrtxQueueFamilyTransfer        transfer,
+                                       uint32_t                       srcQueueFamilyIndex,
+                                       uint32_t                       dstQueueFamilyIndex,
+                                       const std::vector<HrtxMap_T*>& maps)
+{
+  std::vector<VkDescriptorBufferInfo> buffers;
+  for(const HrtxMap_T* map : maps)
+  {
+    map->appendBvhInputs(buffers);
+  }
+
+  bool                                release = transfer == HRTX_QUEUE_FAMILY_TRANSFER_RELEASE;
+  std::vector<VkBufferMemoryBarrier2> barriers;
+  for(const VkDescriptorBufferInfo& buffer : buffers)
+  {
+    barriers.push_back(VkBufferMemoryBarrier2{
+        VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER_2,
+        nullptr,
+        release ? VK_PIPELINE_STAGE_2_MICROMAP_BUILD_BIT_EXT | VK_PIPELINE_STAGE_2_TRANSFER_BIT | VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT :
+                  VK_PIPELINE_STAGE_2_NONE,
+        release ? VK_ACCESS_2_MICROMAP_WRITE_BIT_EXT | VK_ACCESS_2_TRANSFER_WRITE_BIT | VK_ACCESS_2_SHADER_WRITE_BIT :
+                  VK_ACCESS_2_NONE,
+        release ? VK_PIPELINE_STAGE_2_NONE : VK_PIPELINE_STAGE_2_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+        release ? VK_ACCESS_2_NONE : VK_ACCESS_2_ACCELERATION_STRUCTURE_READ_BIT_KHR | VK_ACCESS_2_MICROMAP_READ_BIT_EXT,
+        srcQueueFamilyIndex,
+        dstQueueFamilyIndex,
+        buffer.buffer,
+        buffer.offset,
+        buffer.range,
+    });
+  }
+  bufferBarriers2(cmd, hrtxPipeline.ctx(), barriers);
+}
@@ -17,16 +17,28 @@
 
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
 #include <heightmap_rtx.h>
 #include <array>
+#include <atomic>
+#include <condition_variable>
 #include <memory>
+#include <mutex>
+#include <thread>
 #include <algorithm>
+#include <limits>
+#include <utility>
+#include <vector>
 #include <vulkan/vulkan_core.h>
 #include <context.hpp>
 #include <vulkan_objects.hpp>
 #include <vulkan_bindings.hpp>
+#include <buffer_arena.hpp>
+#include <bias_scale_table.hpp>
+#include <heightmap_table.hpp>
 #include <compress.comp.h>
+#include <tessellate.comp.h>
 #include <bird_curve_table.h>
 
 namespace shaders {
@@ -58,87 +70,549 @@ public:
   }
 };
 
+inline VkDeviceSize micromapScratchAlignment(const HrtxContext& ctx)
+{
+  // For each element of pInfos, its scratchData.deviceAddress member must: be
+  // a multiple of
+  // VkPhysicalDeviceAccelerationStructurePropertiesKHR::minAccelerationStructureScratchOffsetAlignment
+  VkPhysicalDeviceAccelerationStructurePropertiesKHR asProps{};
+  asProps.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_PROPERTIES_KHR;
+  VkPhysicalDeviceProperties2 props2{
+      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
+      &asProps,
+      {},
+  };
+  ctx.vk.vkGetPhysicalDeviceProperties2(ctx.physicalDevice, &props2);
+  VkDeviceSize scratchAlignment = asProps.minAccelerationStructureScratchOffsetAlignment;
+  return scratchAlignment;
+}
+
+// Micromap build inputs and storage offsets must be 256 byte aligned
+static constexpr VkDeviceSize micromapBuildInputAlignment = 256;
+
+// Default size of the buffers BufferArena suballocates from
+static constexpr VkDeviceSize defaultArenaBlockSize = 32 * 1024 * 1024;
+
+// Highest subdivision level supported by the compress shader. One pipeline
+// variant is created for each level.
+static constexpr uint32_t maxSubdivisionLevel = 5;
+static_assert(COMPRESS_LEVEL_COUNT == maxSubdivisionLevel + 1, "level lists must cover every subdivision level");
+
+// Maps with a higher subdivision level are pre-tessellated into 4^(level -
+// maxSubdivisionLevel) triangles per base triangle, up to this level
+static constexpr uint32_t maxPretessellatedSubdivisionLevel = 9;
+
+// Size of the edge decimation flags of a map with adaptive levels, one byte
+// per triangle padded to the 32 bit words written by the levels passes
+inline VkDeviceSize primitiveFlagsSize(uint32_t primitiveCount)
+{
+  return align_up(VkDeviceSize(primitiveCount), VkDeviceSize(sizeof(uint32_t)));
+}
+
+// Returns the compress shader's workgroup size, i.e. the requested size, or
+// COMPRESS_DEFAULT_WORKGROUP_SIZE if zero, clamped to the device limits. Each
+// workgroup bakes as many compression blocks as it has threads and needs
+// COMPRESS_SHARED_WORDS_PER_THREAD words of shared memory per block.
+inline uint32_t compressWorkgroupSize(const HrtxContext& ctx, uint32_t requested)
+{
+  VkPhysicalDeviceProperties2 props2{
+      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
+      nullptr,
+      {},
+  };
+  ctx.vk.vkGetPhysicalDeviceProperties2(ctx.physicalDevice, &props2);
+  const VkPhysicalDeviceLimits& limits      = props2.properties.limits;
+  uint32_t                      threadBytes = COMPRESS_SHARED_WORDS_PER_THREAD * uint32_t(sizeof(uint32_t));
+  uint32_t                      maxSize     = std::min({limits.maxComputeWorkGroupSize[0], limits.maxComputeWorkGroupInvocations,
+                                                        limits.maxComputeSharedMemorySize / threadBytes});
+  uint32_t                      size        = requested ? requested : COMPRESS_DEFAULT_WORKGROUP_SIZE;
+  return std::max(1U, std::min(size, maxSize));
+}
+
+// Returns the maximum number of heightmaps that can be bound to the compress
+// shader at once, i.e. the maximum unique heightmaps per batch of maps.
+inline uint32_t maxHeightmapDescriptors(const HrtxContext& ctx)
+{
+  VkPhysicalDeviceProperties2 props2{
+      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
+      nullptr,
+      {},
+  };
+  ctx.vk.vkGetPhysicalDeviceProperties2(ctx.physicalDevice, &props2);
+  const VkPhysicalDeviceLimits& limits = props2.properties.limits;
+  return std::min({limits.maxPerStageDescriptorSamplers, limits.maxPerStageDescriptorSampledImages,
+                   limits.maxDescriptorSetSamplers, limits.maxDescriptorSetSampledImages});
+}
+
+// Nanoseconds per timestamp query tick
+inline float deviceTimestampPeriod(const HrtxContext& ctx)
+{
+  VkPhysicalDeviceProperties2 props2{
+      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
+      nullptr,
+      {},
+  };
+  ctx.vk.vkGetPhysicalDeviceProperties2(ctx.physicalDevice, &props2);
+  return props2.properties.limits.timestampPeriod;
+}
+
+// Resources that are only needed until the commands they were recorded into
+// have completed
+class Transient
+{
+public:
+  virtual ~Transient() = default;
+  virtual void release() = 0;
+};
+
 struct HrtxPipeline_T
 {
 public:
-  using BirdTableBinding = SingleBinding<BINDING_COMPRESS_BIRD_TABLE, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER>;
-  using HeightmapBinding = SingleBinding<BINDING_COMPRESS_HEIGHTMAP, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER>;
-
-  HrtxPipeline_T(VkCommandBuffer        initCommands,
-                 VkPhysicalDevice       physicalDevice,
-                 VkDevice               device,
-                 HrtxAllocatorCallbacks allocator,
-                 PFN_hrtxCheckVkResult  checkResultCallback,
-                 VkPipelineCache        pipelineCache)
+  using BirdTableBinding  = SingleBinding<BINDING_COMPRESS_BIRD_TABLE, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER>;
+  using HeightmapBinding  = VariableArrayBinding<BINDING_COMPRESS_HEIGHTMAP, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER>;
+  using CompressPipelines = std::array<std::unique_ptr<ComputePipeline>, (maxSubdivisionLevel + 1) * 2 + 5>;
+
+  HrtxPipeline_T(VkCommandBuffer                  initCommands,
+                 VkPhysicalDevice                 physicalDevice,
+                 VkDevice                         device,
+                 HrtxAllocatorCallbacks           allocator,
+                 PFN_hrtxCheckVkResult            checkResultCallback,
+                 VkPipelineCache                  pipelineCache,
+                 VkDeviceSize                     arenaBlockSize,
+                 uint32_t                         workgroupSize,
+                 HrtxPipelineInstrumentationFlags instrumentationFlags,
+                 HrtxPipelineCreateFlags          flags,
+                 uint32_t                         heightmapCount,
+                 const uint32_t*                  compressShaderCode,
+                 size_t                           compressShaderCodeSize,
+                 const void*                      pipelineCacheData,
+                 size_t                           pipelineCacheDataSize)
       : m_ctx(physicalDevice, device, allocator, checkResultCallback)
-      , m_shaderCompress(m_ctx, compress_comp, sizeof(compress_comp))
+      , m_shaderCompress(m_ctx,
+                         compressShaderCode ? compressShaderCode : compress_comp,
+                         compressShaderCode ? compressShaderCodeSize : sizeof(compress_comp))
+      , m_shaderTessellate(m_ctx, tessellate_comp, sizeof(tessellate_comp))
       , m_birdTableBinding(m_ctx)
       , m_birdTable(m_ctx,
                     static_cast<VkDeviceSize>(m_blockToBirdUVTable.size() * sizeof(m_blockToBirdUVTable[0])),
                     VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT)
       , m_birdTableDescriptors(m_ctx, m_birdTableBinding, m_birdTable.descriptor())
-      , m_heightmapBinding(m_ctx)
+      , m_heightmapBinding(m_ctx, maxHeightmapDescriptors(m_ctx))
+      , m_heightmapTable((flags & HRTX_PIPELINE_CREATE_BINDLESS_HEIGHTMAPS_BIT) ?
+                             std::make_unique<HeightmapTable>(m_ctx, bindlessHeightmapCount(m_ctx, heightmapCount)) :
+                             nullptr)
       , m_pipelineLayout(m_ctx,
-                         {m_birdTableBinding.layout(), m_heightmapBinding.layout()},
+                         {m_birdTableBinding.layout(), heightmapLayout()},
                          {VkPushConstantRange{VK_SHADER_STAGE_COMPUTE_BIT, 0,
                                               static_cast<uint32_t>(sizeof(shaders::CompressPushConstants))}})
-      , m_pipeline(m_ctx, m_pipelineLayout, m_shaderCompress, nullptr, pipelineCache)
+      , m_tessellatePipelineLayout(m_ctx,
+                                   {},
+                                   {VkPushConstantRange{VK_SHADER_STAGE_COMPUTE_BIT, 0,
+                                                        static_cast<uint32_t>(sizeof(shaders::TessellatePushConstants))}})
+      , m_workgroupSize(compressWorkgroupSize(m_ctx, workgroupSize))
+      , m_ownedPipelineCache(pipelineCache ? nullptr : std::make_unique<PipelineCache>(m_ctx, pipelineCacheDataSize,
+                                                                                        pipelineCacheData))
+      , m_pipelineCache(pipelineCache ? pipelineCache : VkPipelineCache(*m_ownedPipelineCache))
+      , m_scratchArena(m_ctx,
+                       VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_MICROMAP_BUILD_INPUT_READ_ONLY_BIT_EXT
+                           | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+                       std::max(micromapScratchAlignment(m_ctx), VkDeviceSize(4)),
+                       arenaBlockSize)
+      , m_bakeArena(m_ctx,
+                    VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT
+                        | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_MICROMAP_BUILD_INPUT_READ_ONLY_BIT_EXT,
+                    micromapBuildInputAlignment,
+                    arenaBlockSize)
+      , m_micromapArena(m_ctx,
+                        VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_MICROMAP_STORAGE_BIT_EXT,
+                        micromapBuildInputAlignment,
+                        arenaBlockSize)
+      , m_vertexDataArena(m_ctx,
+                          VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT
+                              | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT
+                              | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR,
+                          16,
+                          arenaBlockSize)
+      , m_biasScaleTable(m_ctx)
+      , m_instrumentationFlags(instrumentationFlags)
+      , m_timestampPeriod(deviceTimestampPeriod(m_ctx))
   {
     m_birdTable.update(initCommands, m_blockToBirdUVTable.data());
+    compilePipelines(flags);
   }
-  HrtxPipeline_T(VkCommandBuffer           initCommands,
-                 VkInstance                instance,
-                 PFN_vkGetInstanceProcAddr getInstanceProcAddr,
-                 VkPhysicalDevice          physicalDevice,
-                 VkDevice                  device,
-                 PFN_vkGetDeviceProcAddr   getDeviceProcAddr,
-                 HrtxAllocatorCallbacks    allocator,
-                 PFN_hrtxCheckVkResult     checkResultCallback,
-                 VkPipelineCache           pipelineCache)
+  HrtxPipeline_T(VkCommandBuffer                  initCommands,
+                 VkInstance                       instance,
+                 PFN_vkGetInstanceProcAddr        getInstanceProcAddr,
+                 VkPhysicalDevice                 physicalDevice,
+                 VkDevice                         device,
+                 PFN_vkGetDeviceProcAddr          getDeviceProcAddr,
+                 HrtxAllocatorCallbacks           allocator,
+                 PFN_hrtxCheckVkResult            checkResultCallback,
+                 VkPipelineCache                  pipelineCache,
+                 VkDeviceSize                     arenaBlockSize,
+                 uint32_t                         workgroupSize,
+                 HrtxPipelineInstrumentationFlags instrumentationFlags,
+                 HrtxPipelineCreateFlags          flags,
+                 uint32_t                         heightmapCount,
+                 const uint32_t*                  compressShaderCode,
+                 size_t                           compressShaderCodeSize,
+                 const void*                      pipelineCacheData,
+                 size_t                           pipelineCacheDataSize)
       : m_ctx(instance, getInstanceProcAddr, physicalDevice, device, getDeviceProcAddr, allocator, checkResultCallback)
-      , m_shaderCompress(m_ctx, compress_comp, sizeof(compress_comp))
+      , m_shaderCompress(m_ctx,
+                         compressShaderCode ? compressShaderCode : compress_comp,
+                         compressShaderCode ? compressShaderCodeSize : sizeof(compress_comp))
+      , m_shaderTessellate(m_ctx, tessellate_comp, sizeof(tessellate_comp))
       , m_birdTableBinding(m_ctx)
       , m_birdTable(m_ctx,
                     static_cast<VkDeviceSize>(m_blockToBirdUVTable.size() * sizeof(m_blockToBirdUVTable[0])),
                     VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT)
       , m_birdTableDescriptors(m_ctx, m_birdTableBinding, m_birdTable.descriptor())
-      , m_heightmapBinding(m_ctx)
+      , m_heightmapBinding(m_ctx, maxHeightmapDescriptors(m_ctx))
+      , m_heightmapTable((flags & HRTX_PIPELINE_CREATE_BINDLESS_HEIGHTMAPS_BIT) ?
+                             std::make_unique<HeightmapTable>(m_ctx, bindlessHeightmapCount(m_ctx, heightmapCount)) :
+                             nullptr)
       , m_pipelineLayout(m_ctx,
-                         {m_birdTableBinding.layout(), m_heightmapBinding.layout()},
+                         {m_birdTableBinding.layout(), heightmapLayout()},
                          {VkPushConstantRange{VK_SHADER_STAGE_COMPUTE_BIT, 0,
                                               static_cast<uint32_t>(sizeof(shaders::CompressPushConstants))}})
-      , m_pipeline(m_ctx, m_pipelineLayout, m_shaderCompress, nullptr, pipelineCache)
+      , m_tessellatePipelineLayout(m_ctx,
+                                   {},
+                                   {VkPushConstantRange{VK_SHADER_STAGE_COMPUTE_BIT, 0,
+                                                        static_cast<uint32_t>(sizeof(shaders::TessellatePushConstants))}})
+      , m_workgroupSize(compressWorkgroupSize(m_ctx, workgroupSize))
+      , m_ownedPipelineCache(pipelineCache ? nullptr : std::make_unique<PipelineCache>(m_ctx, pipelineCacheDataSize,
+                                                                                        pipelineCacheData))
+      , m_pipelineCache(pipelineCache ? pipelineCache : VkPipelineCache(*m_ownedPipelineCache))
+      , m_scratchArena(m_ctx,
+                       VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_MICROMAP_BUILD_INPUT_READ_ONLY_BIT_EXT
+                           | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+                       std::max(micromapScratchAlignment(m_ctx), VkDeviceSize(4)),
+                       arenaBlockSize)
+      , m_bakeArena(m_ctx,
+                    VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT
+                        | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_MICROMAP_BUILD_INPUT_READ_ONLY_BIT_EXT,
+                    micromapBuildInputAlignment,
+                    arenaBlockSize)
+      , m_micromapArena(m_ctx,
+                        VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_MICROMAP_STORAGE_BIT_EXT,
+                        micromapBuildInputAlignment,
+                        arenaBlockSize)
+      , m_vertexDataArena(m_ctx,
+                          VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT
+                              | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT
+                              | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR,
+                          16,
+                          arenaBlockSize)
+      , m_biasScaleTable(m_ctx)
+      , m_instrumentationFlags(instrumentationFlags)
+      , m_timestampPeriod(deviceTimestampPeriod(m_ctx))
   {
     m_birdTable.update(initCommands, m_blockToBirdUVTable.data());
+    compilePipelines(flags);
+  }
+  ~HrtxPipeline_T()
+  {
+    if(m_compileThread.joinable())
+    {
+      m_compileThread.join();
+    }
   }
   HrtxPipeline_T(const HrtxPipeline_T& other)                                 = delete;
   HrtxPipeline_T&                      operator=(const HrtxPipeline_T& other) = delete;
-  std::unique_ptr<SingleDescriptorSet> createHeightmapDescriptors(VkDescriptorImageInfo heightmapDescriptorInfo) const
+  std::unique_ptr<SingleDescriptorSet> createHeightmapDescriptors(const std::vector<VkDescriptorImageInfo>& heightmapDescriptorInfos) const
+  {
+    assert(heightmapDescriptorInfos.size() <= maxHeightmaps());
+    return std::make_unique<SingleDescriptorSet>(m_ctx, m_heightmapBinding, heightmapDescriptorInfos);
+  }
+  uint32_t maxHeightmaps() const { return m_heightmapBinding.maxCount(); }
+
+  // Pipeline-owned heightmap descriptors with
+  // HRTX_PIPELINE_CREATE_BINDLESS_HEIGHTMAPS_BIT, otherwise null and each bake
+  // allocates its own with createHeightmapDescriptors()
+  HeightmapTable* heightmapTable() { return m_heightmapTable.get(); }
+
+  // Returns true if a bake can bind all of the given unique heightmaps at once.
+  // With the pipeline's table, they are also held in it by pin until the bake
+  // has acquired its own references.
+  bool pinHeightmaps(const std::vector<VkDescriptorImageInfo>& heightmapDescriptorInfos, HeightmapTablePin& pin)
+  {
+    return m_heightmapTable ? pin.acquire(*m_heightmapTable, heightmapDescriptorInfos) :
+                              heightmapDescriptorInfos.size() <= maxHeightmaps();
+  }
+  // False while HRTX_PIPELINE_CREATE_DEFERRED_COMPILE_BIT compilation is
+  // running on the background thread
+  bool pipelinesReady() const { return m_pipelinesReady.load(std::memory_order_acquire); }
+  void waitForPipelines() const
+  {
+    if(!pipelinesReady())
+    {
+      std::unique_lock<std::mutex> lock(m_compileMutex);
+      m_compileDone.wait(lock, [this] { return pipelinesReady(); });
+    }
+  }
+
+  // Data of the cache the shaders were compiled with, as vkGetPipelineCacheData()
+  VkResult pipelineCacheData(size_t* dataSize, void* data) const
   {
-    return std::make_unique<SingleDescriptorSet>(m_ctx, m_heightmapBinding, heightmapDescriptorInfo);
+    waitForPipelines();
+    return m_ctx.vk.vkGetPipelineCacheData(m_ctx.device, m_pipelineCache, dataSize, data);
   }
+
+  // Workgroup size of the compress shader, which is also the number of
+  // compression blocks baked by each workgroup
+  uint32_t workgroupSize() const { return m_workgroupSize; }
+
+  // Dispatches the compress shader variant for subdivisionLevel and pass, one
+  // of COMPRESS_PASS_*. All geometries in pushConstants must have the same
+  // subdivision level, except for the levels pass.
   void bindAndDispatch(VkCommandBuffer                      cmd,
-                       const SingleDescriptorSet&           heightmapDescriptors,
+                       VkDescriptorSet                      heightmapDescriptors,
                        const shaders::CompressPushConstants pushConstants,
-                       int32_t                              groupCountX) const
+                       int32_t                              groupCountX,
+                       uint32_t                             subdivisionLevel,
+                       uint32_t                             pass) const
   {
-    std::vector<VkDescriptorSet> descriptorSets = {m_birdTableDescriptors, heightmapDescriptors};
-    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, m_pipelineLayout, 0,
-                            static_cast<uint32_t>(descriptorSets.size()), descriptorSets.data(), 0, nullptr);
-    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, m_pipeline);
-    vkCmdPushConstants(cmd, m_pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(pushConstants), &pushConstants);
+    bind(cmd, heightmapDescriptors, pushConstants, subdivisionLevel, pass);
     vkCmdDispatch(cmd, groupCountX, 1, 1);
   }
+
+  // bindAndDispatch() with the workgroup count read from a
+  // VkDispatchIndirectCommand in buffer at offset
+  void bindAndDispatchIndirect(VkCommandBuffer                      cmd,
+                               VkDescriptorSet                      heightmapDescriptors,
+                               const shaders::CompressPushConstants pushConstants,
+                               VkBuffer                             buffer,
+                               VkDeviceSize                         offset,
+                               uint32_t                             subdivisionLevel,
+                               uint32_t                             pass) const
+  {
+    bind(cmd, heightmapDescriptors, pushConstants, subdivisionLevel, pass);
+    vkCmdDispatchIndirect(cmd, buffer, offset);
+  }
+
+  // Dispatches the tessellate shader for one map
+  void tessellate(VkCommandBuffer cmd, const shaders::TessellatePushConstants& pushConstants) const
+  {
+    uint32_t verticesPerTriangle  = ((pushConstants.segments + 1) * (pushConstants.segments + 2)) / 2;
+    uint32_t trianglesPerTriangle = pushConstants.segments * pushConstants.segments;
+    uint64_t threadCount          = uint64_t(pushConstants.triangleCount) * std::max(verticesPerTriangle, trianglesPerTriangle);
+    waitForPipelines();
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, *m_tessellatePipeline);
+    vkCmdPushConstants(cmd, m_tessellatePipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(pushConstants), &pushConstants);
+    vkCmdDispatch(cmd, static_cast<uint32_t>((threadCount + TESSELLATE_WORKGROUP_SIZE - 1) / TESSELLATE_WORKGROUP_SIZE), 1, 1);
+  }
   const HrtxContext& ctx() const { return m_ctx; }
 
+  // Suballocators for micromap build scratch memory, transient bake inputs,
+  // micromap storage and per-vertex map data respectively
+  BufferArena& scratchArena() { return m_scratchArena; }
+  BufferArena& bakeArena() { return m_bakeArena; }
+  BufferArena& micromapArena() { return m_micromapArena; }
+  BufferArena& vertexDataArena() { return m_vertexDataArena; }
+
+  // Bias and scale for every map created with this pipeline
+  BiasScaleTable& biasScaleTable() { return m_biasScaleTable; }
+
+  // Queries recorded around each bake, see BakeQueries
+  HrtxPipelineInstrumentationFlags instrumentationFlags() const { return m_instrumentationFlags; }
+  float                            timestampPeriod() const { return m_timestampPeriod; }
+
+  // Transient resources are tracked with the command buffer they were
+  // recorded into, so that they can be released in bulk with a timeline value
+  // once that command buffer is submitted. Other threads' recordings are
+  // tagged only when their own command buffers are.
+  void trackTransient(VkCommandBuffer cmd, std::weak_ptr<Transient> transient)
+  {
+    std::lock_guard<std::mutex> lock(m_transientsMutex);
+    m_pendingTransients.push_back({cmd, std::numeric_limits<uint64_t>::max(), std::move(transient)});
+  }
+  void markTransientsSubmitted(uint32_t commandBufferCount, const VkCommandBuffer* commandBuffers, uint64_t submitValue)
+  {
+    const VkCommandBuffer*      commandBuffersEnd = commandBuffers + commandBufferCount;
+    std::lock_guard<std::mutex> lock(m_transientsMutex);
+    for(PendingTransient& pending : m_pendingTransients)
+    {
+      if(pending.submitValue == std::numeric_limits<uint64_t>::max()
+         && std::find(commandBuffers, commandBuffersEnd, pending.cmd) != commandBuffersEnd)
+      {
+        pending.submitValue = submitValue;
+      }
+    }
+  }
+  void releaseTransients(uint64_t completedValue)
+  {
+    std::lock_guard<std::mutex> lock(m_transientsMutex);
+    auto                        retired = std::remove_if(m_pendingTransients.begin(), m_pendingTransients.end(),
+                                  [completedValue](const PendingTransient& pending) {
+                                    // Forget transients once all their users are destroyed
+                                    std::shared_ptr<Transient> transient = pending.transient.lock();
+                                    if(!transient)
+                                    {
+                                      return true;
+                                    }
+                                    if(pending.submitValue > completedValue)
+                                    {
+                                      return false;
+                                    }
+                                    transient->release();
+                                    return true;
+                                  });
+    m_pendingTransients.erase(retired, m_pendingTransients.end());
+  }
+
+  void statistics(HrtxPipelineStatistics* statistics) const
+  {
+    *statistics                 = HrtxPipelineStatistics{};
+    statistics->scratchArena    = m_scratchArena.statistics();
+    statistics->bakeArena       = m_bakeArena.statistics();
+    statistics->micromapArena   = m_micromapArena.statistics();
+    statistics->vertexDataArena = m_vertexDataArena.statistics();
+    m_biasScaleTable.statistics(statistics);
+    if(m_heightmapTable)
+    {
+      m_heightmapTable->statistics(statistics);
+    }
+
+    // Transients of destroyed maps are only forgotten by releaseTransients()
+    std::lock_guard<std::mutex> lock(m_transientsMutex);
+    for(const PendingTransient& pending : m_pendingTransients)
+    {
+      if(!pending.transient.expired())
+      {
+        ++statistics->pendingBakeResourceCount;
+        if(pending.submitValue == std::numeric_limits<uint64_t>::max())
+        {
+          ++statistics->unsubmittedBakeResourceCount;
+        }
+      }
+    }
+  }
+
 private:
+  VkDescriptorSetLayout heightmapLayout() const
+  {
+    return m_heightmapTable ? m_heightmapTable->layout() : m_heightmapBinding.layout();
+  }
+
+  void bind(VkCommandBuffer                      cmd,
+            VkDescriptorSet                      heightmapDescriptors,
+            const shaders::CompressPushConstants pushConstants,
+            uint32_t                             subdivisionLevel,
+            uint32_t                             pass) const
+  {
+    assert(subdivisionLevel <= maxSubdivisionLevel);
+    waitForPipelines();
+    std::array<VkDescriptorSet, 2> descriptorSets{m_birdTableDescriptors, heightmapDescriptors};
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, m_pipelineLayout, 0,
+                            static_cast<uint32_t>(descriptorSets.size()), descriptorSets.data(), 0, nullptr);
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, *m_pipelines[pipelineIndex(subdivisionLevel, pass)]);
+    vkCmdPushConstants(cmd, m_pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(pushConstants), &pushConstants);
+  }
+
+  // The adaptive levels passes and the select pass do not depend on the
+  // subdivision level and have a single variant each after those of the bake
+  // passes
+  static bool     perLevelPass(uint32_t pass) { return pass == COMPRESS_PASS_MAIN || pass == COMPRESS_PASS_BOUNDS; }
+  static uint32_t pipelineIndex(uint32_t subdivisionLevel, uint32_t pass)
+  {
+    return perLevelPass(pass) ? subdivisionLevel + pass * (maxSubdivisionLevel + 1) :
+                                (maxSubdivisionLevel + 1) * 2 + pass - COMPRESS_PASS_LEVELS;
+  }
+
+  // Runs createPipelines(), on a background thread with
+  // HRTX_PIPELINE_CREATE_DEFERRED_COMPILE_BIT
+  void compilePipelines(HrtxPipelineCreateFlags flags)
+  {
+    if(!(flags & HRTX_PIPELINE_CREATE_DEFERRED_COMPILE_BIT))
+    {
+      createPipelines();
+      m_pipelinesReady.store(true, std::memory_order_release);
+      return;
+    }
+    m_compileThread = std::thread([this] {
+      createPipelines();
+      std::lock_guard<std::mutex> lock(m_compileMutex);
+      m_pipelinesReady.store(true, std::memory_order_release);
+      m_compileDone.notify_all();
+    });
+  }
+
+  // Creates a variant of the compress shader for each subdivision level and
+  // pass with the level, pass and workgroup size as specialization constants,
+  // so that the per-level block layout math folds to constants
+  void createPipelines()
+  {
+    struct SpecializationData
+    {
+      uint32_t workgroupSize;
+      uint32_t subdivisionLevel;
+      uint32_t pass;
+    };
+    const std::array<VkSpecializationMapEntry, 3> mapEntries{{
+        {COMPRESS_SPEC_WORKGROUP_SIZE, offsetof(SpecializationData, workgroupSize), sizeof(uint32_t)},
+        {COMPRESS_SPEC_SUBDIVISION_LEVEL, offsetof(SpecializationData, subdivisionLevel), sizeof(uint32_t)},
+        {COMPRESS_SPEC_PASS, offsetof(SpecializationData, pass), sizeof(uint32_t)},
+    }};
+    for(uint32_t pass : {COMPRESS_PASS_MAIN, COMPRESS_PASS_BOUNDS, COMPRESS_PASS_LEVELS, COMPRESS_PASS_SELECT,
+                         COMPRESS_PASS_LEVELS_DILATE, COMPRESS_PASS_LEVELS_MIN, COMPRESS_PASS_LEVELS_LIST})
+    {
+      for(uint32_t level = 0; level <= (perLevelPass(pass) ? maxSubdivisionLevel : 0); ++level)
+      {
+        SpecializationData   data{m_workgroupSize, level, pass};
+        VkSpecializationInfo specialization{static_cast<uint32_t>(mapEntries.size()), mapEntries.data(), sizeof(data), &data};
+        m_pipelines[pipelineIndex(level, pass)] =
+            std::make_unique<ComputePipeline>(m_ctx, m_pipelineLayout, m_shaderCompress, &specialization,
+                                              m_pipelineCache);
+      }
+    }
+    m_tessellatePipeline = std::make_unique<ComputePipeline>(m_ctx, m_tessellatePipelineLayout, m_shaderTessellate,
+                                                             nullptr, m_pipelineCache);
+  }
+
   BlockToBirdUVTable  m_blockToBirdUVTable;
   HrtxContext         m_ctx;
   ShaderModule        m_shaderCompress;
+  ShaderModule        m_shaderTessellate;
   BirdTableBinding    m_birdTableBinding;
   Buffer              m_birdTable;
   SingleDescriptorSet m_birdTableDescriptors;
   HeightmapBinding    m_heightmapBinding;
+
+  std::unique_ptr<HeightmapTable> m_heightmapTable;
   PipelineLayout      m_pipelineLayout;
-  ComputePipeline     m_pipeline;
+  PipelineLayout      m_tessellatePipelineLayout;
+  uint32_t            m_workgroupSize;
+  CompressPipelines   m_pipelines;
+
+  std::unique_ptr<ComputePipeline> m_tessellatePipeline;
+
+  // Compiled shader variants are written by m_compileThread, if any, before
+  // m_pipelinesReady is set
+  std::unique_ptr<PipelineCache>  m_ownedPipelineCache;
+  VkPipelineCache                 m_pipelineCache;
+  std::atomic<bool>               m_pipelinesReady{false};
+  mutable std::mutex              m_compileMutex;
+  mutable std::condition_variable m_compileDone;
+  std::thread                     m_compileThread;
+
+  BufferArena         m_scratchArena;
+  BufferArena         m_bakeArena;
+  BufferArena         m_micromapArena;
+  BufferArena         m_vertexDataArena;
+  BiasScaleTable      m_biasScaleTable;
+
+  HrtxPipelineInstrumentationFlags m_instrumentationFlags;
+  float                            m_timestampPeriod;
+
+  // Tagged with the value from markTransientsSubmitted(), or the maximum
+  // uint64_t if the command buffer has not been submitted yet
+  struct PendingTransient
+  {
+    VkCommandBuffer          cmd;
+    uint64_t                 submitValue;
+    std::weak_ptr<Transient> transient;
+  };
+  mutable std::mutex            m_transientsMutex;
+  std::vector<PendingTransient> m_pendingTransients;
 };
@@ -0,0 +1,246 @@
+/*
+ * SPDX-FileCopyrightText: Copyright (c) 2023 NVIDIA CORPORATION & AFFILIATES. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <vulkan/vulkan_core.h>
+#include <heightmap_rtx.h>
+#include <hrtx_pipeline.hpp>
+#include <buffer_arena.hpp>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// Layout of the data written by hrtxMapSerializedData(). A header is followed
+// by the micromap usages and then the micromap build inputs, per-vertex bias
+// and scale and adaptive edge decimation flags, exactly as they are in device
+// memory. These are in the
+// standard VK_NV_displacement_micromap formats, so unlike a serialized
+// micromap the data does not depend on the device or driver. Only the
+// micromap build is repeated when loading.
+struct SerializedMapHeader
+{
+  static constexpr uint32_t currentMagic   = 0x5854524DU;  // "MRTX"
+  static constexpr uint32_t currentVersion = 2;
+
+  uint32_t     magic;
+  uint32_t     version;
+  uint64_t     createHash;  // serializedCreateHash() of the HrtxMapCreate baked
+  uint32_t     usageCount;
+  uint32_t     triangleCount;
+  VkDeviceSize valuesSize;
+  VkDeviceSize trianglesSize;
+  VkDeviceSize vertexBiasAndScaleSize;
+  VkDeviceSize primitiveFlagsSize;
+
+  bool         valid() const { return magic == currentMagic && version == currentVersion; }
+  VkDeviceSize deviceDataSize() const
+  {
+    return valuesSize + trianglesSize + vertexBiasAndScaleSize + primitiveFlagsSize;
+  }
+  size_t       usagesSize() const { return usageCount * sizeof(VkMicromapUsageEXT); }
+  size_t       hostSize() const { return sizeof(SerializedMapHeader) + usagesSize(); }
+  size_t       totalSize() const { return hostSize() + static_cast<size_t>(deviceDataSize()); }
+};
+
+// FNV-1a hash of the HrtxMapCreate parameters that change the baked data.
+// Buffer contents cannot be hashed without reading them back, so the
+// application is expected to store the data keyed by its own asset identity
+// and this only catches data loaded for a different configuration.
+inline uint64_t serializedCreateHash(const HrtxMapCreate& create)
+{
+  uint64_t hash = 14695981039346656037ULL;
+  auto     add  = [&hash](const void* data, size_t size) {
+    for(size_t i = 0; i < size; ++i)
+    {
+      hash = (hash ^ static_cast<const uint8_t*>(data)[i]) * 1099511628211ULL;
+    }
+  };
+  HrtxMapCreateFlags bakedFlags = create.flags
+                                  & (HRTX_MAP_CREATE_DISPLACEMENT_BOUNDS_BIT | HRTX_MAP_CREATE_ADAPTIVE_SUBDIVISION_BIT
+                                     | HRTX_MAP_CREATE_SEAMLESS_EDGES_BIT | HRTX_MAP_CREATE_FOOTPRINT_MIP_SAMPLING_BIT);
+  add(&create.primitiveCount, sizeof(create.primitiveCount));
+  add(&create.subdivisionLevel, sizeof(create.subdivisionLevel));
+  add(&bakedFlags, sizeof(bakedFlags));
+
+  // Displacement bounds and direction length compensation include the bias
+  // and scale
+  if(bakedFlags & HRTX_MAP_CREATE_DISPLACEMENT_BOUNDS_BIT)
+  {
+    add(&create.triangles->maxVertex, sizeof(create.triangles->maxVertex));
+  }
+  if(bakedFlags & (HRTX_MAP_CREATE_DISPLACEMENT_BOUNDS_BIT | HRTX_MAP_CREATE_SEAMLESS_EDGES_BIT))
+  {
+    add(&create.heightmapBias, sizeof(create.heightmapBias));
+    add(&create.heightmapScale, sizeof(create.heightmapScale));
+  }
+  return hash;
+}
+
+// Checked view of serialized data passed to
+// hrtxCmdCreateMapFromSerializedData(). The data may end after the usages if
+// the device data is in a buffer.
+struct SerializedMapView
+{
+  SerializedMapHeader             header;
+  std::vector<VkMicromapUsageEXT> usages;
+  const char*                     deviceData;  // device data in the order of the header's sizes, or null
+
+  // Returns VK_ERROR_FORMAT_NOT_SUPPORTED if data was not written by this
+  // version of the library for the same create parameters
+  VkResult parse(const HrtxMapCreate& create, size_t dataSize, const void* data)
+  {
+    if(dataSize < sizeof(header))
+    {
+      return VK_ERROR_FORMAT_NOT_SUPPORTED;
+    }
+    memcpy(&header, data, sizeof(header));
+    if(!header.valid() || header.createHash != serializedCreateHash(create)
+       || header.triangleCount != create.primitiveCount || header.usageCount > maxSubdivisionLevel + 1
+       || (dataSize != header.hostSize() && dataSize != header.totalSize()))
+    {
+      return VK_ERROR_FORMAT_NOT_SUPPORTED;
+    }
+    VkDeviceSize expectedBiasAndScaleSize = (create.flags & HRTX_MAP_CREATE_DISPLACEMENT_BOUNDS_BIT) ?
+                                                (VkDeviceSize(create.triangles->maxVertex) + 1) * sizeof(float) * 2 :
+                                                0;
+    VkDeviceSize expectedPrimitiveFlagsSize =
+        (create.flags & HRTX_MAP_CREATE_ADAPTIVE_SUBDIVISION_BIT) ? primitiveFlagsSize(create.primitiveCount) : 0;
+    if(header.trianglesSize != VkDeviceSize(header.triangleCount) * sizeof(VkMicromapTriangleEXT)
+       || header.vertexBiasAndScaleSize != expectedBiasAndScaleSize
+       || header.primitiveFlagsSize != expectedPrimitiveFlagsSize || header.valuesSize == 0)
+    {
+      return VK_ERROR_FORMAT_NOT_SUPPORTED;
+    }
+    const char* usagesData = static_cast<const char*>(data) + sizeof(header);
+    usages.resize(header.usageCount);
+    memcpy(usages.data(), usagesData, header.usagesSize());
+    deviceData = dataSize == header.totalSize() ? usagesData + header.usagesSize() : nullptr;
+
+    uint64_t usageTriangles = 0;
+    for(const VkMicromapUsageEXT& usage : usages)
+    {
+      if(usage.subdivisionLevel > maxSubdivisionLevel)
+      {
+        return VK_ERROR_FORMAT_NOT_SUPPORTED;
+      }
+      usageTriangles += usage.count;
+    }
+    return usageTriangles == header.triangleCount ? VK_SUCCESS : VK_ERROR_FORMAT_NOT_SUPPORTED;
+  }
+};
+
+// Identifies archives written by writeMapArchive(), versioned with
+// SerializedMapHeader
+static constexpr uint32_t mapArchiveMagic = 0x4154524DU;  // "MRTA"
+
+// Writes an archive of serialized maps for hrtxMapArchiveWrite(). Each map's
+// device data is aligned so that it can be streamed straight from a memory
+// mapped file into a staging buffer.
+inline VkResult writeMapArchive(uint32_t           mapCount,
+                                const uint64_t*    keys,
+                                const size_t*      dataSizes,
+                                const void* const* data,
+                                size_t*            archiveSize,
+                                void*              archive)
+{
+  const uint64_t                   alignment = micromapBuildInputAlignment;
+  std::vector<HrtxMapArchiveEntry> entries(mapCount);
+  uint64_t                         size = sizeof(HrtxMapArchiveHeader) + mapCount * sizeof(HrtxMapArchiveEntry);
+  for(uint32_t i = 0; i < mapCount; ++i)
+  {
+    SerializedMapHeader header;
+    if(dataSizes[i] < sizeof(header))
+    {
+      return VK_ERROR_FORMAT_NOT_SUPPORTED;
+    }
+    memcpy(&header, data[i], sizeof(header));
+    if(!header.valid() || header.usageCount > maxSubdivisionLevel + 1 || dataSizes[i] != header.totalSize())
+    {
+      return VK_ERROR_FORMAT_NOT_SUPPORTED;
+    }
+    entries[i] = HrtxMapArchiveEntry{
+        keys[i],
+        align_up(size + header.hostSize(), alignment) - header.hostSize(),
+        header.hostSize(),
+        header.deviceDataSize(),
+    };
+    size = entries[i].offset + dataSizes[i];
+  }
+
+  if(!archive)
+  {
+    *archiveSize = static_cast<size_t>(size);
+    return VK_SUCCESS;
+  }
+  if(*archiveSize < size)
+  {
+    return VK_INCOMPLETE;
+  }
+  *archiveSize = static_cast<size_t>(size);
+
+  // Zero the padding so that archives are reproducible
+  char*                dst = static_cast<char*>(archive);
+  HrtxMapArchiveHeader header{mapArchiveMagic, SerializedMapHeader::currentVersion, mapCount,
+                              static_cast<uint32_t>(alignment)};
+  memset(dst, 0, static_cast<size_t>(size));
+  memcpy(dst, &header, sizeof(header));
+  memcpy(dst + sizeof(header), entries.data(), entries.size() * sizeof(HrtxMapArchiveEntry));
+  for(uint32_t i = 0; i < mapCount; ++i)
+  {
+    memcpy(dst + entries[i].offset, data[i], dataSizes[i]);
+  }
+  return VK_SUCCESS;
+}
+
+// Reads the entry table of an archive for hrtxMapArchiveEntries(), checking
+// that each entry lies within the archive
+inline VkResult readMapArchiveEntries(size_t               archiveSize,
+                                      const void*          archive,
+                                      uint32_t*            entryCount,
+                                      HrtxMapArchiveEntry* entries)
+{
+  HrtxMapArchiveHeader header;
+  if(archiveSize < sizeof(header))
+  {
+    return VK_ERROR_FORMAT_NOT_SUPPORTED;
+  }
+  memcpy(&header, archive, sizeof(header));
+  if(header.magic != mapArchiveMagic || header.version != SerializedMapHeader::currentVersion
+     || archiveSize < sizeof(header) + uint64_t(header.entryCount) * sizeof(HrtxMapArchiveEntry))
+  {
+    return VK_ERROR_FORMAT_NOT_SUPPORTED;
+  }
+  if(!entries)
+  {
+    *entryCount = header.entryCount;
+    return VK_SUCCESS;
+  }
+
+  const char* src = static_cast<const char*>(archive) + sizeof(header);
+  *entryCount     = std::min(*entryCount, header.entryCount);
+  for(uint32_t i = 0; i < *entryCount; ++i)
+  {
+    memcpy(&entries[i], src + i * sizeof(HrtxMapArchiveEntry), sizeof(HrtxMapArchiveEntry));
+    const HrtxMapArchiveEntry& entry = entries[i];
+    if(entry.offset > archiveSize || entry.hostDataSize + entry.deviceDataSize > archiveSize - entry.offset)
+    {
+      return VK_ERROR_FORMAT_NOT_SUPPORTED;
+    }
+  }
+  return *entryCount < header.entryCount ? VK_INCOMPLETE : VK_SUCCESS;
+}
@@ -76,17 +76,24 @@ private:
   VkDescriptorSetLayout m_layout;
 };
 
-// A VkDescriptorPool with just enough space for the given bindings
+// A VkDescriptorPool with just enough space for the given bindings. Bindings
+// with VK_DESCRIPTOR_BINDING_VARIABLE_DESCRIPTOR_COUNT_BIT take
+// variableDescriptorCount descriptors rather than the layout's maximum.
 class SingleDescriptorSetPool
 {
 public:
-  SingleDescriptorSetPool(const HrtxContext& ctx, const DescriptorSetLayoutBindings& bindingsAndFlags, VkDescriptorPoolCreateFlags flags = 0)
+  SingleDescriptorSetPool(const HrtxContext&                 ctx,
+                          const DescriptorSetLayoutBindings& bindingsAndFlags,
+                          uint32_t                           variableDescriptorCount = 0,
+                          VkDescriptorPoolCreateFlags        flags                   = 0)
       : m_ctx(ctx)
   {
     std::unordered_map<VkDescriptorType, uint32_t> typeSizes;
     for(auto& obj : bindingsAndFlags)
     {
-      typeSizes[obj.binding.descriptorType]++;
+      typeSizes[obj.binding.descriptorType] += (obj.bindingFlags & VK_DESCRIPTOR_BINDING_VARIABLE_DESCRIPTOR_COUNT_BIT) ?
+                                                   variableDescriptorCount :
+                                                   obj.binding.descriptorCount;
     }
     std::vector<VkDescriptorPoolSize> poolSizes;
     for(auto& typeSize : typeSizes)
@@ -118,12 +125,19 @@ private:
 class DescriptorSet
 {
 public:
-  DescriptorSet(const HrtxContext& ctx, VkDescriptorPool pool, VkDescriptorSetLayout descriptorSetLayout)
+  DescriptorSet(const HrtxContext& ctx, VkDescriptorPool pool, VkDescriptorSetLayout descriptorSetLayout, uint32_t variableDescriptorCount = 0)
       : m_ctx(ctx)
   {
+    // Only needed if the last binding has VK_DESCRIPTOR_BINDING_VARIABLE_DESCRIPTOR_COUNT_BIT
+    VkDescriptorSetVariableDescriptorCountAllocateInfo variableCountInfo = {
+        VK_STRUCTURE_TYPE_DESCRIPTOR_SET_VARIABLE_DESCRIPTOR_COUNT_ALLOCATE_INFO,
+        nullptr,
+        1,
+        &variableDescriptorCount,  //
+    };
     VkDescriptorSetAllocateInfo allocInfo = {
         VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
-        nullptr,
+        variableDescriptorCount ? &variableCountInfo : nullptr,
         pool,
         1,
         &descriptorSetLayout,  //
@@ -154,9 +168,18 @@ public:
   {
     binding.write(*this, descriptor);
   }
-  SingleDescriptorSet(const HrtxContext& ctx, const DescriptorSetLayoutBindings& bindingsAndFlags, const DescriptorSetLayout& layout)
-      : m_pool(ctx, bindingsAndFlags)
-      , m_set(ctx, m_pool, layout)
+  template <class ArrayBinding, class DescriptorInfo>
+  SingleDescriptorSet(const HrtxContext& ctx, const ArrayBinding& binding, const std::vector<DescriptorInfo>& descriptors)
+      : SingleDescriptorSet(ctx, binding.bindings(), binding.layout(), static_cast<uint32_t>(descriptors.size()))
+  {
+    binding.write(*this, descriptors);
+  }
+  SingleDescriptorSet(const HrtxContext&                 ctx,
+                      const DescriptorSetLayoutBindings& bindingsAndFlags,
+                      const DescriptorSetLayout&         layout,
+                      uint32_t                           variableDescriptorCount = 0)
+      : m_pool(ctx, bindingsAndFlags, variableDescriptorCount)
+      , m_set(ctx, m_pool, layout, variableDescriptorCount)
   {
   }
   operator VkDescriptorSet() const { return m_set; }
@@ -221,10 +244,15 @@ VkWriteDescriptorSet makeWriteDescriptorSet(const DescriptorBindingAndFlags&   b
 {
   VkWriteDescriptorSet result{
       VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+      nullptr,
       descriptorSet,
       binding.binding.binding,
+      0,
       static_cast<uint32_t>(descriptorInfo.size()),
       binding.binding.descriptorType,
+      nullptr,
+      nullptr,
+      nullptr,
   };
   setWriteDescriptorSetPtr(result, descriptorInfo.data());
   assert((binding.bindingFlags & VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT) ?
@@ -294,3 +322,38 @@ private:
   DescriptorSetLayoutBindings m_bindings;
   DescriptorSetLayout         m_layout;
 };
+
+// A single binding for an array of descriptors. The array size is chosen per
+// descriptor set when it is allocated, up to maxCount.
+template <uint32_t BindingIndex, VkDescriptorType BindAs, VkShaderStageFlags Stages = VK_SHADER_STAGE_ALL>
+class VariableArrayBinding
+{
+public:
+  VariableArrayBinding(const HrtxContext& ctx, uint32_t maxCount)
+      : m_bindings{DescriptorBindingAndFlags{
+          {
+              BindingIndex,
+              BindAs,
+              maxCount,
+              Stages,
+              nullptr,
+          },
+          VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT | VK_DESCRIPTOR_BINDING_VARIABLE_DESCRIPTOR_COUNT_BIT,
+      }}
+      , m_layout(ctx, m_bindings)
+  {
+  }
+  template <class DescriptorInfo>
+  void write(VkDescriptorSet descriptorSet, const std::vector<DescriptorInfo>& descriptors) const
+  {
+    DescriptorSetWrites writes{makeWriteDescriptorSet(m_bindings[0], descriptorSet, descriptors)};
+    updateDescriptorSets(m_layout.ctx().device, writes);
+  }
+  const DescriptorSetLayoutBindings& bindings() const { return m_bindings; }
+  const DescriptorSetLayout&         layout() const { return m_layout; }
+  uint32_t                           maxCount() const { return m_bindings[0].binding.descriptorCount; }
+
+private:
+  DescriptorSetLayoutBindings m_bindings;
+  DescriptorSetLayout         m_layout;
+};
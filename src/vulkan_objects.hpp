@@ -22,6 +22,8 @@
 #include <heightmap_rtx.h>
 #include <context.hpp>
 #include <cassert>
+#include <algorithm>
+#include <vector>
 
 class Buffer
 {
@@ -57,7 +59,16 @@ public:
   }
   VkDeviceSize           size() const { return m_size; }
   VkDescriptorBufferInfo descriptor() const { return {*this, 0, m_size}; }
-  void update(VkCommandBuffer cmd, const void* data) const { m_ctx.vk.vkCmdUpdateBuffer(cmd, *this, 0, m_size, data); }
+  void update(VkCommandBuffer cmd, const void* data) const
+  {
+    // vkCmdUpdateBuffer() is limited to 65536 bytes per call
+    const VkDeviceSize maxUpdateSize = 65536;
+    for(VkDeviceSize offset = 0; offset < m_size; offset += maxUpdateSize)
+    {
+      m_ctx.vk.vkCmdUpdateBuffer(cmd, *this, offset, std::min(maxUpdateSize, m_size - offset),
+                                 static_cast<const char*>(data) + offset);
+    }
+  }
   void copy(VkCommandBuffer cmd, const Buffer& other) const
   {
     assert(size() == other.size());
@@ -66,6 +77,10 @@ public:
   }
   void clear(VkCommandBuffer cmd, uint32_t value = 0) const { m_ctx.vk.vkCmdFillBuffer(cmd, *this, 0, m_size, value); }
 
+  // Host pointer to a HOST_VISIBLE buffer's memory, or null if the optional
+  // HrtxAllocatorCallbacks::mapBuffer was not provided
+  void* map() const { return m_ctx.allocator.mapBuffer ? m_ctx.allocator.mapBuffer(m_buffer, m_ctx.allocator.userPtr) : nullptr; }
+
 private:
   const HrtxContext& m_ctx;
   VkDeviceSize       m_size;
@@ -176,6 +191,64 @@ private:
   VkPipeline         m_pipeline;
 };
 
+class PipelineCache
+{
+public:
+  PipelineCache(const PipelineCache& other)            = delete;
+  PipelineCache& operator=(const PipelineCache& other) = delete;
+  PipelineCache(const HrtxContext& ctx, size_t initialDataSize, const void* initialData)
+      : m_ctx(ctx)
+  {
+    VkPipelineCacheCreateInfo pipelineCacheCreate{
+        VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
+        nullptr,
+        0,
+        initialDataSize,
+        initialData,
+    };
+    m_ctx.checkResult(m_ctx.vk.vkCreatePipelineCache(m_ctx.device, &pipelineCacheCreate,
+                                                     m_ctx.allocator.systemAllocator, &m_pipelineCache));
+  }
+  ~PipelineCache() noexcept
+  {
+    m_ctx.vk.vkDestroyPipelineCache(m_ctx.device, m_pipelineCache, m_ctx.allocator.systemAllocator);
+  }
+  operator const VkPipelineCache&() const { return m_pipelineCache; }
+
+private:
+  const HrtxContext& m_ctx;
+  VkPipelineCache    m_pipelineCache;
+};
+
+class QueryPool
+{
+public:
+  QueryPool(const QueryPool& other)            = delete;
+  QueryPool& operator=(const QueryPool& other) = delete;
+  QueryPool(const HrtxContext& ctx, VkQueryType queryType, uint32_t queryCount, VkQueryPipelineStatisticFlags pipelineStatistics = 0)
+      : m_ctx(ctx)
+      , m_queryCount(queryCount)
+  {
+    VkQueryPoolCreateInfo queryPoolCreate{
+        VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+        nullptr,
+        0,
+        queryType,
+        queryCount,
+        pipelineStatistics,
+    };
+    m_ctx.checkResult(m_ctx.vk.vkCreateQueryPool(m_ctx.device, &queryPoolCreate, m_ctx.allocator.systemAllocator, &m_queryPool));
+  }
+  ~QueryPool() noexcept { m_ctx.vk.vkDestroyQueryPool(m_ctx.device, m_queryPool, m_ctx.allocator.systemAllocator); }
+  operator const VkQueryPool&() const { return m_queryPool; }
+  void cmdReset(VkCommandBuffer cmd) const { m_ctx.vk.vkCmdResetQueryPool(cmd, m_queryPool, 0, m_queryCount); }
+
+private:
+  const HrtxContext& m_ctx;
+  uint32_t           m_queryCount;
+  VkQueryPool        m_queryPool;
+};
+
 inline void memoryBarrier(VkCommandBuffer&     cmd,
                           const HrtxContext&   ctx,
                           VkPipelineStageFlags srcStageMask,
@@ -222,3 +295,19 @@ inline void memoryBarrier2(VkCommandBuffer&      cmd,
   };
   ctx.vk.vkCmdPipelineBarrier2(cmd, &depencencyInfo);
 }
+
+inline void bufferBarriers2(VkCommandBuffer& cmd, const HrtxContext& ctx, const std::vector<VkBufferMemoryBarrier2>& barriers)
+{
+  VkDependencyInfo depencencyInfo = {
+      VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+      nullptr,
+      0,
+      0,
+      nullptr,
+      static_cast<uint32_t>(barriers.size()),
+      barriers.data(),
+      0,
+      nullptr,  //
+  };
+  ctx.vk.vkCmdPipelineBarrier2(cmd, &depencencyInfo);
+}